@@ -16,7 +16,7 @@ do
     ;;
   esac
 done
-echo  g++ -o $output ${POSITIONAL[@]} `pkg-config --cflags --libs opencv --libs gl`
-g++ -o $output ${POSITIONAL[@]} `pkg-config --cflags --libs opencv --libs gl`
+echo  g++ -O2 -o $output ${POSITIONAL[@]} `pkg-config --cflags --libs opencv --libs gl`
+g++ -O2 -o $output ${POSITIONAL[@]} `pkg-config --cflags --libs opencv --libs gl`
 
 echo ""
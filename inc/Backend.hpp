@@ -0,0 +1,60 @@
+// Interchangeable implementations of the pipeline stages, picked at run
+// time instead of with the compile-time OCV_* switches. Every stage lists
+// the backends it has; a spec such as "gray=opencv,canny=threaded" selects
+// them, and BACKEND_AUTO lets CannyContext time the candidates on the
+// first frame and keep the fastest. Its candidates are only the backends
+// with the same output, so a frame's result never depends on the timing;
+// BACKEND_AUTO_OPENCV also times opencv, for speed over reproducibility.
+//
+// By Steven Chen
+
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <string>
+
+enum PipeStage {
+  PIPE_GRAY = 0,  // MyColorToGray / cv::cvtColor
+  PIPE_DENOISE,   // MedianFilter + BoxFilter / cv::medianBlur + cv::blur
+  PIPE_SOBEL,     // MySobel / cv::Sobel, the gradients inside MyCanny
+  PIPE_CANNY,     // MyCanny / cv::Canny
+  PIPE_LABEL,     // LabelConnected / cv::connectedComponents
+  PIPE_THRESHOLD, // otsu_threshold / cv::threshold with THRESH_OTSU
+  PIPE_STAGES
+};
+
+enum Backend {
+  BACKEND_AUTO = 0, // time the stage's own backends on the first frame, keep the fastest
+  BACKEND_SCALAR,   // own code, portable scalar path
+  BACKEND_SIMD,     // own code, SIMD path of CannyOptions::simd
+  BACKEND_THREADED, // own code on cv::parallel_for_
+  BACKEND_OPENCV,
+  BACKEND_AUTO_OPENCV, // "auto+opencv": like BACKEND_AUTO, opencv among the candidates
+  BACKEND_COUNT
+};
+
+const char* PipeStageName(PipeStage stage);
+const char* BackendName(Backend backend);
+
+// Whether stage has an implementation for backend, always true for the autos
+bool BackendAvailable(PipeStage stage, Backend backend);
+// Whether auto_backend times backend for stage. BACKEND_AUTO only takes the
+// own backends, which give the same output bit for bit; opencv does not
+// (blur includes the centre pixel, other Sobel border, Canny and Otsu
+// rounding, no perimeter column) and only BACKEND_AUTO_OPENCV takes it.
+bool BackendAutoCandidate(PipeStage stage, Backend auto_backend, Backend backend);
+// Whether backend is BACKEND_AUTO or BACKEND_AUTO_OPENCV
+bool BackendIsAuto(Backend backend);
+// What every stage runs unless told otherwise: the SIMD paths, serial labeling
+void DefaultBackends(Backend backends[PIPE_STAGES]);
+
+// Parse "stage=backend" entries separated by commas, spaces or new lines,
+// e.g. "gray=opencv, canny=auto". Stage "all" sets every stage that has
+// the backend. "@file" reads the entries from a file, where # starts a
+// comment. Stages not named are left as they are. Returns false, with a
+// message in error, on an unknown name or a backend the stage does not have.
+bool ParseBackends(const std::string& spec, Backend backends[PIPE_STAGES], std::string& error);
+// "gray=simd,denoise=simd,..."
+std::string BackendsString(const Backend backends[PIPE_STAGES]);
+
+#endif // BACKEND_HPP
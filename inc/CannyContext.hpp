@@ -0,0 +1,102 @@
+// Canny edge detection and connected components as one pipeline with
+// state: the context owns every buffer of the pipeline, sized on the first
+// frame and reused by the next ones, and keeps the smoothed image and NMS
+// map of the current frame so that new thresholds only redo hysteresis
+// and the labels. Every stage runs the backend chosen for it (Backend.hpp);
+// the auto ones time their candidates on the first frame of each size and
+// type and keep the fastest.
+//
+// By Steven Chen
+
+#ifndef CANNY_CONTEXT_HPP
+#define CANNY_CONTEXT_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+
+#include "Backend.hpp"
+#include "MyCanny.hpp"
+#include "MyFilter.hpp"
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+
+class CannyContext
+{
+public:
+  // Options, set before SetImage
+  Backend backends[PIPE_STAGES]; // DefaultBackends unless set
+  CannyOptions canny_opts; // exec and sobel follow the canny and sobel backends
+  bool rgb;           // MyColorToGray channel order
+  int median_radius;  // MedianFilter radius, 0 leaves it out
+  int box_radius;     // BoxFilter radius, 0 for the 3x3 average of the 8 neighbours
+  uint connectivity;  // 4 or 8
+  int label_threads;  // threaded label backend: threads, 0 keeps cv::getNumThreads()
+  bool edge_runs;     // label the edges with LabelRuns (no stats, background not labeled), whatever the label backend
+  bool sorted_candidates; // hysteresis from the NMS pixels sorted by magnitude
+
+  // Results, read only. Images share the context's buffers and are
+  // overwritten by the next SetImage/Detect.
+  cv::Mat gray, smoothed;        // SetImage
+  cv::Mat binary, binary_labels; // SetImage: Otsu binary image and its components
+  int otsu_value, num_binary_objects;
+  cv::Mat nms;                   // Detect: NMS map, kept while frame and options stay
+  cv::Mat edges, edge_labels;    // Detect
+  cv::Mat edge_stats, edge_centroids; // Detect, empty with edge_runs
+  int num_edge_objects;
+  Backend selected[PIPE_STAGES]; // backend every stage ran with, auto ones resolved
+  double tune_ms[PIPE_STAGES][BACKEND_COUNT]; // auto stages: time of every candidate, 0 when not timed
+
+  CannyContext();
+
+  // A new frame: gray conversion, smoothing and the Otsu binary image.
+  // src is kept (not copied) in case the filter options change.
+  void SetImage(const cv::Mat& src);
+  // Edges of the current frame and their connected components. The stages
+  // before hysteresis only run again when the frame or their options changed.
+  void Detect(int lo_threshold, int hi_threshold);
+
+  // Times a buffer of the pipeline needed new heap memory. Once frames keep
+  // their size and options it only grows when a frame has more edge
+  // candidates or labels than any before, so it settles after a few frames.
+  // Only these buffers are counted, not what the OpenCV backends,
+  // parallel_for_ or the stage callbacks allocate inside.
+  long Allocations() const;
+
+private:
+  void Smooth();
+  bool NmsValid(const CannyOptions& opts) const;
+  Backend Select(PipeStage stage, const std::function<void(Backend)>& run);
+  Backend Tune(PipeStage stage, Backend auto_backend, const std::function<void(Backend)>& run);
+  SimdPath StageSimd(Backend backend) const;
+  CannyOptions StageOptions(Backend sobel, Backend canny) const;
+  void Gray(Backend backend);
+  void Denoise(Backend backend);
+  void Threshold(Backend backend);
+  void LabelBinary(Backend backend);
+  void LabelEdges(Backend backend);
+
+  cv::Mat src;
+  // options the smoothed image and the NMS map were made with
+  bool smoothed_rgb;
+  int smoothed_median_radius, smoothed_box_radius;
+  long frame_id, nms_frame_id;
+  CannyOptions nms_opts;
+  bool nms_sorted;
+  // frames the auto backends were tuned on
+  cv::Size tuned_size;
+  int tuned_type;
+  Backend tuned[PIPE_STAGES];
+  Backend tuned_by[PIPE_STAGES]; // the auto kind tuned was picked among
+
+  ScratchBuf frame_buf; // gray_buf, smoothed, binary, edges
+  cv::Mat gray_buf;     // gray of a color frame, gray shares a gray one
+  cv::Mat gray16;       // OpenCV gray of a 16-bit frame
+  FilterBuf filter_buf;
+  CannyBuf canny_buf;
+  CannyCandidates candidates;
+  cv::Mat map_edges;    // MyCannyHysteresis of the map, edges shares it or candidates.edges
+  LabelBuf edge_label_buf, binary_label_buf;
+};
+
+#endif // CANNY_CONTEXT_HPP
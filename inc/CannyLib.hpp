@@ -0,0 +1,136 @@
+// Public API of libmycanny: Canny edge detection, connected components
+// and Otsu threshold for a program that links the library instead of
+// building the sources. Only OpenCV core is needed to include it; the
+// library itself is built without HighGUI. Link libmycanny.so: the static
+// libmycanny.a also carries the internal functions (MyCanny, LabelConnected
+// and the others) under their global names, which may clash with the
+// program's own.
+//
+// Outputs are written into the caller's cv::Mat when it already has the
+// size and type given below, so a caller that keeps its outputs and a
+// Workspace per thread reuses their memory from image to image; otherwise
+// they are (re)allocated like cv::Mat::create. The ImageView overloads work
+// on memory the caller owns and never allocate an output. No call copies
+// or pads its input: the filters handle the image border in the kernel.
+// Bad input throws cv::Exception.
+//
+// By Steven Chen
+
+#ifndef CANNY_LIB_HPP
+#define CANNY_LIB_HPP
+
+#include <opencv2/core.hpp>
+
+#ifdef __GNUC__
+  // libmycanny.so exports this API only
+  #define MYCV_API __attribute__((visibility("default")))
+#else
+  #define MYCV_API
+#endif
+
+namespace mycv {
+
+// Scratch buffers of the calls below. Not thread-safe: use one per thread,
+// and keep it across images of the same size so its buffers are reused.
+class MYCV_API Workspace
+{
+public:
+  Workspace();
+  ~Workspace();
+  // Times a buffer needed new heap memory, settles after a few images.
+  // What OpenCV allocates inside is not counted.
+  long Allocations() const;
+
+  struct Impl;
+  Impl& impl() { return *p; }
+
+private:
+  Workspace(const Workspace&) = delete;
+  Workspace& operator=(const Workspace&) = delete;
+  Impl* p;
+};
+
+// Pixels in memory the caller owns, e.g. a frame in shared memory written
+// by a capture process. The calls read and write them in place; an input
+// view is never written. stride: bytes from one row to the next.
+struct ImageView {
+  uchar* data;
+  int width, height;
+  size_t stride;
+  int type; // CV_8UC1, CV_8UC3, CV_16SC1, ...
+  ImageView(const void* data, int width, int height, size_t stride, int type=CV_8UC1) :
+    data((uchar*)data), width(width), height(height), stride(stride), type(type) {}
+
+  // A rectangle of the view, e.g. a region of interest of a frame. The
+  // pixels around it are not read: its border is handled like a frame's.
+  ImageView Roi(int x, int y, int w, int h) const
+  {
+    CV_Assert(x >= 0 && y >= 0 && w >= 0 && h >= 0 && x+w <= width && y+h <= height);
+    return ImageView(data + y*stride + x*CV_ELEM_SIZE(type), w, h, stride, type);
+  }
+  // A cv::Mat header over the pixels, no copy
+  cv::Mat AsMat() const { return cv::Mat(height, width, type, data, stride); }
+};
+
+// border: cv::BORDER_REPLICATE, BORDER_REFLECT, BORDER_REFLECT_101 or
+// BORDER_CONSTANT with border_value, for the pixels outside the image
+struct CannyParams {
+  int low_threshold, high_threshold;
+  bool L2gradient;
+  bool rgb;          // channel order of a color src is RGB(A), not BGR(A)
+  int median_radius; // 0 leaves the median filter out
+  int box_radius;    // 0 for the 3x3 average of the 8 neighbours
+  int num_threads;   // 1 serial, 0 all of OpenCV's threads, otherwise bands on at most this many
+  int border;        // of the smoothing filters and the Sobel gradient
+  uchar border_value;
+  CannyParams() : low_threshold(30), high_threshold(90), L2gradient(true), rgb(false),
+                  median_radius(1), box_radius(0), num_threads(1), border(cv::BORDER_REPLICATE), border_value(0) {}
+};
+
+// src: CV_8U or CV_16U with 1, 3 or 4 channels. Gray conversion, median
+// and box smoothing, then Canny. edges: CV_8UC1 of src's size, 255 on the
+// edges, 0 elsewhere.
+MYCV_API void Canny(const cv::Mat& src, cv::Mat& edges, const CannyParams& params, Workspace& ws);
+MYCV_API void Canny(const ImageView& src, const ImageView& edges, const CannyParams& params, Workspace& ws);
+
+// The filters of Canny on their own, CV_8UC1 in and out; dst may be src.
+// Median: (2*radius+1)^2 window, 0 <= radius <= 127.
+MYCV_API void Median(const cv::Mat& src, cv::Mat& dst, int radius, Workspace& ws,
+                     int border=cv::BORDER_REPLICATE, uchar border_value=0);
+MYCV_API void Median(const ImageView& src, const ImageView& dst, int radius, Workspace& ws,
+                     int border=cv::BORDER_REPLICATE, uchar border_value=0);
+// Box: rounded average of the (2*radius+1)^2 window, radius 0 for the 3x3
+// average of the 8 neighbours
+MYCV_API void Box(const cv::Mat& src, cv::Mat& dst, int radius, Workspace& ws,
+                  int border=cv::BORDER_REPLICATE, uchar border_value=0);
+MYCV_API void Box(const ImageView& src, const ImageView& dst, int radius, Workspace& ws,
+                  int border=cv::BORDER_REPLICATE, uchar border_value=0);
+// Sobel: 3x3 gradients, grad_x and grad_y CV_16SC1
+MYCV_API void Sobel(const cv::Mat& src, cv::Mat& grad_x, cv::Mat& grad_y, Workspace& ws,
+                    int border=cv::BORDER_REPLICATE, uchar border_value=0);
+MYCV_API void Sobel(const ImageView& src, const ImageView& grad_x, const ImageView& grad_y, Workspace& ws,
+                    int border=cv::BORDER_REPLICATE, uchar border_value=0);
+
+// img: CV_8UC1, every region of equal pixels is one object, background
+// included, numbered from 0 in raster order. labels: CV_32SC1 of img's
+// size. connectivity: 4 or 8. num_threads as in CannyParams.
+// Returns the number of objects.
+MYCV_API int Label(const cv::Mat& img, cv::Mat& labels, Workspace& ws, int connectivity=8, int num_threads=1);
+MYCV_API int Label(const ImageView& img, const ImageView& labels, Workspace& ws, int connectivity=8, int num_threads=1);
+// Also the statistics of every object, like cv::connectedComponentsWithStats
+// with one more column, the perimeter (LabelConnected.hpp). stats (CV_32S)
+// and centroids (CV_64F) get one row per object; they keep their memory
+// while it has room for the objects, like a std::vector.
+MYCV_API int Label(const cv::Mat& img, cv::Mat& labels, cv::Mat& stats, cv::Mat& centroids, Workspace& ws,
+                   int connectivity=8, int num_threads=1);
+MYCV_API int Label(const ImageView& img, const ImageView& labels, cv::Mat& stats, cv::Mat& centroids, Workspace& ws,
+                   int connectivity=8, int num_threads=1);
+
+// gray: CV_8UC1. binary: CV_8UC1 of gray's size, 255 above the threshold
+// (0 with invert). Returns the threshold.
+MYCV_API int Otsu(const cv::Mat& gray, cv::Mat& binary, bool invert=false);
+MYCV_API int Otsu(const ImageView& gray, const ImageView& binary, bool invert=false);
+
+} // namespace mycv
+
+#endif // CANNY_LIB_HPP
@@ -0,0 +1,63 @@
+// Image border of the filters (MedianFilter, BoxFilter, MySobel). The
+// kernels never pad a copy of the frame: pixels outside it are mapped back
+// to source rows and columns, and only the row buffers that the kernels
+// keep anyway get border columns.
+//
+// By Steven Chen
+
+#ifndef FILTER_BORDER_HPP
+#define FILTER_BORDER_HPP
+
+#include <cstring>
+
+#include <opencv2/opencv.hpp>
+
+struct FilterBorder {
+  int type;    // cv::BORDER_REPLICATE, BORDER_REFLECT, BORDER_REFLECT_101 or BORDER_CONSTANT
+  uchar value; // pixels outside the image with BORDER_CONSTANT
+  FilterBorder(int type=cv::BORDER_REPLICATE, uchar value=0) : type(type), value(value)
+  {
+    // no BORDER_WRAP: the rows below the image must be ones the filters
+    // still hold in their window when they run in place
+    CV_Assert(type == cv::BORDER_REPLICATE || type == cv::BORDER_REFLECT || type == cv::BORDER_REFLECT_101 ||
+              type == cv::BORDER_CONSTANT);
+  }
+  bool operator==(const FilterBorder& b) const { return type == b.type && (type != cv::BORDER_CONSTANT || value == b.value); }
+  bool operator!=(const FilterBorder& b) const { return !(*this == b); }
+
+  // Source index of row or column p of an image of len rows or columns,
+  // -1 for a constant pixel
+  int Index(int p, int len) const
+  {
+    if (p >= 0 && p < len)
+      return p;
+    if (type == cv::BORDER_REPLICATE)
+      return p < 0 ? 0 : len-1;
+    return cv::borderInterpolate(p, len, type);
+  }
+
+  // Row y of src, or constant_row (cols pixels of value) outside a BORDER_CONSTANT image
+  const uchar* Row(const cv::Mat& src, int y, const uchar* constant_row) const
+  {
+    int i = Index(y, src.rows);
+    return i < 0 ? constant_row : src.ptr<uchar>(i);
+  }
+
+  // Copy a source row of cols pixels into dst with r border pixels on both sides
+  void PadRow(const uchar* src, uchar* dst, int cols, int r) const
+  {
+    memcpy(dst+r, src, cols);
+    if (type == cv::BORDER_REPLICATE) {
+      memset(dst, src[0], r);
+      memset(dst+r+cols, src[cols-1], r);
+      return;
+    }
+    for (int k=1; k<=r; k++) {
+      int left = Index(-k, cols), right = Index(cols-1+k, cols);
+      dst[r-k] = left < 0 ? value : src[left];
+      dst[r+cols-1+k] = right < 0 ? value : src[right];
+    }
+  }
+};
+
+#endif // FILTER_BORDER_HPP
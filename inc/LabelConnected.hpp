@@ -0,0 +1,72 @@
+// Connected components labeling of equal-valued pixels.
+//
+// By Steven Chen
+
+#ifndef LABEL_CONNECTED_HPP
+#define LABEL_CONNECTED_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "SimdDispatch.hpp"
+
+// img: CV_8UC1, every region of equal pixels is one object (the
+// background too). labels is (re)allocated with depth ltype, objects are
+// numbered 0, 1, 2, ... in order of first appearance in raster order.
+// connectivity: 4 or 8. num_threads: 1 labels serially, otherwise the
+// frame is cut into horizontal strips labeled in parallel, one per
+// thread (0 = cv::getNumThreads()) of OpenCV's pool; the labels are the
+// same. cv::setNumThreads is not changed.
+// ltype: CV_16U, CV_32S, or -1 for CV_16U unless the image may need more
+// than 65536 provisional labels.
+// Returns the number of objects.
+int LabelConnected(const cv::Mat& img, cv::Mat& labels, uint connectivity=8, int num_threads=1, int ltype=-1);
+
+// Scratch of the labelers (LabelSets.hpp). The overloads taking one keep
+// their buffers in it, so a caller that labels frames of the same size
+// over and over reuses them once they have grown.
+struct LabelBuf;
+int LabelConnected(const cv::Mat& img, cv::Mat& labels, LabelBuf& buf, uint connectivity=8, int num_threads=1, int ltype=-1);
+
+// Column of the objects' perimeter in LabelConnectedWithStats' stats,
+// after the cv::ConnectedComponentsTypes columns
+enum {
+  LABEL_STAT_PERIMETER = cv::CC_STAT_MAX, // pixels with a 4-neighbour outside the object or the image
+  LABEL_STAT_MAX
+};
+
+// LabelConnected that also counts, in the same pass that resolves the
+// labels, the statistics of every object like cv::connectedComponentsWithStats.
+// stats: CV_32S, one row per object with cv::CC_STAT_LEFT, TOP, WIDTH,
+// HEIGHT, AREA and LABEL_STAT_PERIMETER. centroids: CV_64F, (x, y) per object.
+int LabelConnectedWithStats(const cv::Mat& img, cv::Mat& labels, cv::Mat& stats, cv::Mat& centroids,
+                            uint connectivity=8, int num_threads=1, int ltype=-1);
+// stats and centroids are the caller's: they keep their memory while it
+// has room for the objects, a larger table is counted in buf's allocations
+int LabelConnectedWithStats(const cv::Mat& img, cv::Mat& labels, cv::Mat& stats, cv::Mat& centroids, LabelBuf& buf,
+                            uint connectivity=8, int num_threads=1, int ltype=-1);
+
+// A run of nonzero pixels [x0, x1) of row y, and its object
+struct LabelRun {
+  int y, x0, x1;
+  int label;
+};
+
+// Run-based labeling of sparse binary or edge images (CV_8UC1): only the
+// nonzero pixels are objects, numbered 1, 2, ... in order of first
+// appearance, and the zero background is 0 (like cv::connectedComponents).
+// The cost follows the number of runs of nonzero pixels rather than the
+// image area. runs: the runs in raster order with their labels.
+// Returns the number of labels, the background included.
+int LabelRuns(const cv::Mat& img, std::vector<LabelRun>& runs, uint connectivity=8, SimdPath simd=SIMD_AUTO);
+// The same as a label image of depth ltype: CV_16U, CV_32S or -1 for
+// CV_16U if the labels fit
+int LabelRuns(const cv::Mat& img, cv::Mat& labels, uint connectivity=8, int ltype=-1, SimdPath simd=SIMD_AUTO);
+int LabelRuns(const cv::Mat& img, cv::Mat& labels, LabelBuf& buf, uint connectivity=8, int ltype=-1, SimdPath simd=SIMD_AUTO);
+
+// Renumber the CV_16UC1 or CV_32SC1 labels of res into dst (of the same
+// size and type) in order of first appearance, returns the number of labels
+int RelabelImg(cv::Mat& res, cv::Mat& dst);
+
+#endif // LABEL_CONNECTED_HPP
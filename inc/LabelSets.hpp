@@ -0,0 +1,129 @@
+// Disjoint sets (Union-Find) of provisional labels, shared by the
+// labeling algorithms.
+//
+// By Steven Chen
+
+#ifndef LABEL_SETS_HPP
+#define LABEL_SETS_HPP
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "LabelConnected.hpp"
+#include "ScratchBuf.hpp"
+
+// Disjoint sets of provisional labels in one preallocated array. The root
+// of a set is its smallest label (parent[i] <= i), FindRoot halves the path
+// on the way up.
+struct LabelSets {
+  std::vector<uint> parent;
+  uint count;  // provisional labels in use
+  uint unions; // Union calls, counted in trace builds only
+  LabelSets(uint max_labels=0) : parent(max_labels), count(0), unions(0) {}
+
+  uint NewLabel()
+  {
+    CV_Assert(count < parent.size()); // more provisional labels than reserved
+    parent[count] = count;
+    return count++;
+  }
+
+  uint FindRoot(uint i)
+  {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // create a link between two labels, smaller label are parents.
+  // Returns the root of the merged set.
+  uint Union(uint a, uint b)
+  {
+    MYCV_TRACE_ONLY(unions++);
+    a = FindRoot(a);
+    b = FindRoot(b);
+    if (a < b)
+      parent[b] = a;
+    else if (b < a)
+      parent[a] = b;
+    return std::min(a, b);
+  }
+
+  // Root lookup and union for several threads working on the same sets.
+  // Links only go from a larger root to a smaller one and are set by
+  // compare-and-swap, so a root linked meanwhile makes the union retry.
+  // No path compression here: the sets are flattened right after.
+  uint FindRootShared(uint i) const
+  {
+    uint p;
+    while ((p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED)) != i)
+      i = p;
+    return i;
+  }
+
+  void UnionShared(uint a, uint b)
+  {
+    for (;;) {
+      a = FindRootShared(a);
+      b = FindRootShared(b);
+      if (a == b)
+        return;
+      if (a < b)
+        std::swap(a, b);
+      uint expected = a;
+      if (__atomic_compare_exchange_n(&parent[a], &expected, b, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    }
+  }
+
+  // Replace parent[] by the final labels 0, 1, 2, ... numbered by root.
+  // Labels are given in raster order and a root is the first label of its
+  // set, so this is also the order of first appearance (RelabelImg order).
+  // parent[p] of any p < i already is final, so one sweep is enough.
+  uint Flatten()
+  {
+    uint num = 0;
+    for (uint i = 0; i < count; i++)
+      parent[i] = (parent[i] == i) ? num++ : parent[parent[i]];
+    return num;
+  }
+};
+
+// Per-object sums of the second pass with statistics
+struct ComponentStats {
+  int left, top, right, bottom;
+  int area;
+  int perimeter; // pixels with a 4-neighbour outside the object or the image
+  int64 sum_x, sum_y;
+  ComponentStats() : left(INT_MAX), top(INT_MAX), right(-1), bottom(-1), area(0), perimeter(0), sum_x(0), sum_y(0) {}
+
+  void Merge(const ComponentStats& s)
+  {
+    left = std::min(left, s.left);
+    top = std::min(top, s.top);
+    right = std::max(right, s.right);
+    bottom = std::max(bottom, s.bottom);
+    area += s.area;
+    perimeter += s.perimeter;
+    sum_x += s.sum_x;
+    sum_y += s.sum_y;
+  }
+};
+
+// Scratch of the labelers, kept by a caller that labels frames of the
+// same size over and over
+struct LabelBuf : ScratchBuf {
+  LabelSets sets;
+  std::vector<LabelSets> strip_sets;  // parallel mode: first pass of every strip
+  std::vector<uint> base;             // parallel mode: first label of every strip in sets
+  std::vector<ComponentStats> stats;
+  std::vector<std::vector<ComponentStats> > strip_stats;
+  std::vector<LabelRun> runs;           // LabelRuns
+};
+
+#endif // LABEL_SETS_HPP
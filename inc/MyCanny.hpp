@@ -0,0 +1,133 @@
+// Canny edge detection stages: Sobel gradient, magnitude,
+// non-maximum suppression and hysteresis threshold.
+//
+// By Steven Chen
+
+#ifndef MY_CANNY_HPP
+#define MY_CANNY_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include "FilterBorder.hpp"
+#include "ScratchBuf.hpp"
+#include "SimdDispatch.hpp"
+
+// 3x3 Sobel of a CV_8UC1 src of any stride, border replicated unless
+// given. grad_x/grad_y are (re)allocated as CV_16S.
+void MySobel(const cv::Mat& src, cv::Mat& grad_x, cv::Mat& grad_y, SimdPath simd=SIMD_AUTO,
+             const FilterBorder& border=FilterBorder());
+// Sobel of the source rows [y0, y1) only; row 0 of grad_x/grad_y is source row y0
+void MySobelRows(const cv::Mat& src, cv::Mat& grad_x, cv::Mat& grad_y, int y0, int y1, SimdPath simd=SIMD_AUTO,
+                 const FilterBorder& border=FilterBorder());
+// Shorts of scratch buf the calls below need
+inline size_t MySobelBufSize(int cols) { return 3*(cols+2); }
+// The same with caller scratch buf
+void MySobelRows(const cv::Mat& src, cv::Mat& grad_x, cv::Mat& grad_y, int y0, int y1, short* buf, SimdPath simd=SIMD_AUTO,
+                 const FilterBorder& border=FilterBorder());
+// Sobel of source row y into caller rows, with caller scratch buf
+void MySobelRow(const cv::Mat& src, int y, short* grad_x, short* grad_y, short* buf, SimdPath simd=SIMD_AUTO,
+                const FilterBorder& border=FilterBorder());
+
+// Gradient's magnitude: L2 round(sqrt(gx^2+gy^2)) or L1 (|gx|+|gy|)/2,
+// depth CV_8U (saturated at 255) or CV_16U
+void GradMagnitude(const cv::Mat& grad_x, const cv::Mat& grad_y, cv::Mat& grad_mag, bool L2gradient, int depth=CV_8U, SimdPath simd=SIMD_AUTO);
+void GradMagnitudeRow(const short* grad_x, const short* grad_y, uchar* grad_mag, int cols, bool L2gradient, int depth, SimdPath simd=SIMD_AUTO);
+
+enum CannyNms {
+  CANNY_NMS_INTERPOLATED = 0, // neighbours interpolated along the exact gradient direction
+  CANNY_NMS_QUANTIZED         // direction quantized into 0/45/90/135 degrees, integer only
+};
+
+// Non-maximum suppression of one row: m0/m1/m2 are the magnitude rows y-1, y, y+1
+// of depth CV_8U or CV_16U, the row borders of nmax_suppress are set to 0
+void NonMaxSuppressRow(const uchar* m0, const uchar* m1, const uchar* m2, const short* grad_x, const short* grad_y,
+                       uchar* nmax_suppress, int cols, int depth, CannyNms mode=CANNY_NMS_INTERPOLATED, SimdPath simd=SIMD_AUTO);
+
+enum CannyExec {
+  CANNY_EXEC_SERIAL = 0, // whole frame, one stage after another
+  CANNY_EXEC_TILED       // horizontal bands with halos on cv::parallel_for_
+};
+
+enum CannySobel {
+  CANNY_SOBEL_MY = 0, // MySobel on CannyOptions::sobel_simd
+  CANNY_SOBEL_OPENCV  // cv::Sobel, the bands keep their real neighbours (BORDER_DEFAULT at the frame border)
+};
+
+enum CannyHysteresis {
+  CANNY_HYST_TRACE = 0,  // edge tracking: weak pixels connected to a strong one by any weak chain
+  CANNY_HYST_SINGLE_PASS // a weak pixel needs a strong one among its 8 direct neighbours
+};
+
+struct CannyOptions {
+  bool L2gradient;
+  CannyExec exec;
+  int num_threads;  // CANNY_EXEC_TILED: threads of OpenCV's pool at most, 0 = cv::getNumThreads(); never set globally
+  int band_height;  // CANNY_EXEC_TILED: rows per band, 0 picks about 4 bands per thread
+  bool fused;       // stream each frame/band through 3-row rings instead of full-size buffers
+  CannyHysteresis hysteresis;
+  int mag_depth;    // magnitude/NMS depth: CV_8U (saturated at 255) or CV_16U
+  CannyNms nms;
+  SimdPath simd;    // magnitude and NMS
+  CannySobel sobel;
+  SimdPath sobel_simd; // MySobel, apart from simd so that the stages can be picked one by one (Backend.hpp)
+  FilterBorder border; // MySobel's image border, the NMS border pixels stay 0
+  CannyOptions() : L2gradient(true), exec(CANNY_EXEC_SERIAL), num_threads(0), band_height(0), fused(false),
+                   hysteresis(CANNY_HYST_TRACE), mag_depth(CV_8U),
+                   nms(CANNY_NMS_INTERPOLATED), simd(SIMD_AUTO), sobel(CANNY_SOBEL_MY), sobel_simd(SIMD_AUTO) {}
+};
+
+// Scratch of one band (the whole frame in serial mode): full-height
+// gradients, magnitude and NMS, or 3-row rings of them in fused mode
+struct CannyBandBuf {
+  cv::Mat grad_x, grad_y;   // CV_16S
+  cv::Mat grad_mag;         // CannyOptions::mag_depth
+  cv::Mat nmax_suppress;    // CannyOptions::mag_depth
+  std::vector<short> sobel_buf;
+  std::vector<uchar*> stack; // edge tracking inside the band
+};
+
+// Scratch of MyCanny, kept by a caller that runs it on frames of the same
+// size and options over and over
+struct CannyBuf : ScratchBuf {
+  std::vector<CannyBandBuf> bands;
+  std::vector<int> candidates; // weak+strong pixels per band
+  std::vector<uchar*> stack;   // edge tracking over the whole frame
+  cv::Mat dbg_mag, dbg_nms;    // debug display
+};
+
+// NMS pixels of a frame sorted by magnitude, strongest first, so that
+// the pixels at or above a threshold are a prefix of offsets. Answers
+// threshold pairs in time proportional to the candidates above lo.
+struct CannyCandidates : ScratchBuf {
+  std::vector<int> offsets;  // y*cols+x of every NMS pixel > 0
+  std::vector<int> count_ge; // count_ge[t]: candidates with magnitude >= t
+  std::vector<int> hist;
+  std::vector<uchar*> stack;
+  cv::Mat edges;             // last result, only offsets[0, marked) can be set
+  int marked;
+  CannyCandidates() : marked(0) {}
+};
+
+// detected_edges is (re)allocated as CV_8U, boundary pixels are set to 0
+void MyCanny(const cv::Mat& src, cv::Mat& detected_edges, int lo_threshold, int hi_threshold, const CannyOptions& opts, bool debug=false);
+void MyCanny(const cv::Mat& src, cv::Mat& detected_edges, int lo_threshold, int hi_threshold, const CannyOptions& opts,
+             CannyBuf& buf, bool debug=false);
+void MyCanny(const cv::Mat& src, cv::Mat& detected_edges, int lo_threshold, int hi_threshold, bool L2gradient=true, bool debug=false);
+
+// MyCanny in two steps, for many threshold pairs on one frame. MyCannyNms
+// runs everything up to NMS into a full-size map of depth opts.mag_depth
+// (the fused option does not apply). MyCannyHysteresis thresholds the map
+// into the same edges as MyCanny with the same opts.
+void MyCannyNms(const cv::Mat& src, cv::Mat& nmax_suppress, const CannyOptions& opts, CannyBuf& buf);
+void MyCannyHysteresis(const cv::Mat& nmax_suppress, cv::Mat& detected_edges, int lo_threshold, int hi_threshold,
+                       const CannyOptions& opts, CannyBuf& buf);
+// Sort the pixels of an NMS map into cand (counting sort), clears cand.edges
+void MyCannySortCandidates(const cv::Mat& nmax_suppress, CannyCandidates& cand);
+// Hysteresis from the sorted pixels into cand.edges: only the candidates of
+// the previous call are cleared and only those >= lo_threshold are visited
+void MyCannyHysteresis(const cv::Mat& nmax_suppress, CannyCandidates& cand, int lo_threshold, int hi_threshold,
+                       CannyHysteresis hysteresis=CANNY_HYST_TRACE);
+
+#endif // MY_CANNY_HPP
@@ -0,0 +1,56 @@
+// Canny pre-processing: gray conversion and smoothing filters. The
+// filters take and return CV_8UC1 images of any stride (a ROI or a
+// header over external memory is read in place), handle the border in
+// the kernel (FilterBorder.hpp, replicated by default), and may run in
+// place (dst is src).
+//
+// By Steven Chen
+
+#ifndef MY_FILTER_HPP
+#define MY_FILTER_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include "FilterBorder.hpp"
+#include "ScratchBuf.hpp"
+#include "SimdDispatch.hpp"
+
+// Scratch of BoxFilter and MedianFilter, kept by a caller that filters
+// frames of the same size over and over
+struct FilterBuf : ScratchBuf {
+  cv::Mat box_ring, median_ring;      // window rows
+  std::vector<int> col_sum, row_sum;  // BoxFilter running sums
+  std::vector<uchar> zeros;
+  std::vector<uchar> border_row;      // BORDER_CONSTANT rows outside the image
+  std::vector<const uchar*> win_rows; // MedianFilter network inputs
+  std::vector<ushort> hist_fine, hist_coarse; // MedianFilter column histograms
+};
+
+// Gray = R*0.299 + G*0.587 + B*0.114 in 16.16 fixed point, img is CV_8UC1.
+// src: CV_8U or CV_16U with 1, 3 (BGR) or 4 (BGRA) channels; rgb: the
+// channel order is RGB/RGBA. 16-bit values are scaled down to 8 bits.
+// A CV_8UC1 src is not copied: img shares its data.
+void MyColorToGray(const cv::Mat& src, cv::Mat& img, bool rgb=false, SimdPath simd=SIMD_AUTO);
+
+// Box filter over a (2*radius+1)^2 window with running sums, so the cost
+// per pixel does not depend on the radius. The average is rounded.
+// exclude_center: leave the centre pixel out and truncate, the
+// original "8 neighbours / 8" filter is radius 1 with exclude_center.
+void BoxFilter(const cv::Mat& src, cv::Mat& dst, int radius, bool exclude_center=false, SimdPath simd=SIMD_AUTO,
+               const FilterBorder& border=FilterBorder());
+void BoxFilter(const cv::Mat& src, cv::Mat& dst, int radius, bool exclude_center, FilterBuf& buf, SimdPath simd=SIMD_AUTO,
+               const FilterBorder& border=FilterBorder());
+// 3x3 average of the 8 neighbours
+void BoxFilter(const cv::Mat& src, cv::Mat& dst);
+
+// Median over a (2*radius+1)^2 window, 0 <= radius <= 127. Radius 1 and 2
+// use a sorting network, larger radii a sliding histogram (O(1) per pixel).
+void MedianFilter(const cv::Mat& src, cv::Mat& dst, int radius, SimdPath simd=SIMD_AUTO, const FilterBorder& border=FilterBorder());
+void MedianFilter(const cv::Mat& src, cv::Mat& dst, int radius, FilterBuf& buf, SimdPath simd=SIMD_AUTO,
+                  const FilterBorder& border=FilterBorder());
+// 3x3 median
+void MedianFilter(const cv::Mat& src, cv::Mat& dst);
+
+#endif // MY_FILTER_HPP
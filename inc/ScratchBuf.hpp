@@ -0,0 +1,44 @@
+// Scratch memory that a caller keeps across calls, so that the kernels
+// reuse the buffers once they have their size.
+//
+// By Steven Chen
+
+#ifndef SCRATCH_BUF_HPP
+#define SCRATCH_BUF_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Trace.hpp"
+
+// Base of the scratch structs. allocations counts every time one of the
+// buffers needed new heap memory; it stops growing in the steady state.
+// Resize/Create may be called from several threads.
+struct ScratchBuf {
+  long allocations;
+  ScratchBuf() : allocations(0) {}
+
+  void CountAllocation()
+  {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    MYCV_TRACE_COUNT("allocations", 1);
+  }
+
+  template<typename T> void Resize(std::vector<T>& v, size_t n)
+  {
+    if (n > v.capacity())
+      CountAllocation();
+    v.resize(n);
+  }
+
+  // cv::Mat::create keeps the data only when size and type are unchanged
+  void Create(cv::Mat& m, int rows, int cols, int type)
+  {
+    if ((m.rows != rows || m.cols != cols || m.type() != type || m.empty()) && rows > 0 && cols > 0)
+      CountAllocation();
+    m.create(rows, cols, type);
+  }
+};
+
+#endif // SCRATCH_BUF_HPP
@@ -0,0 +1,47 @@
+// Runtime selection of the SIMD code path used by the image kernels.
+// SIMD_AUTO picks the widest instruction set the CPU supports; any explicit
+// request is lowered to what is really available, so a kernel never runs
+// instructions the host does not have. cv::setUseOptimized(false) forces
+// the scalar path everywhere.
+//
+// By Steven Chen
+
+#ifndef SIMD_DISPATCH_HPP
+#define SIMD_DISPATCH_HPP
+
+#include <opencv2/opencv.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define MYCV_X86 1
+  #include <emmintrin.h>
+  #include <immintrin.h>
+  // per-function target attribute, so the file still builds without -mavx2
+  #define MYCV_TARGET_SSSE3 __attribute__((target("ssse3")))
+  #define MYCV_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+enum SimdPath {
+  SIMD_AUTO = 0,
+  SIMD_NONE,   // portable scalar code
+  SIMD_SSE2,
+  SIMD_AVX2
+};
+
+inline SimdPath ResolveSimdPath(SimdPath requested)
+{
+#ifdef MYCV_X86
+  if (requested == SIMD_NONE || !cv::useOptimized())
+    return SIMD_NONE;
+  bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+  if (requested == SIMD_AUTO)
+    return avx2 ? SIMD_AVX2 : SIMD_SSE2;
+  if (requested == SIMD_AVX2 && !avx2)
+    return SIMD_SSE2;
+  return requested;
+#else
+  (void)requested;
+  return SIMD_NONE;
+#endif
+}
+
+#endif // SIMD_DISPATCH_HPP
@@ -0,0 +1,86 @@
+// Lock-free ring buffer between exactly one producer thread and one
+// consumer thread. The producer only writes tail and the consumer only
+// writes head, each on its own cache line, so neither takes a lock.
+// Push waits while the ring is full: a slow consumer holds the producer
+// back (backpressure) instead of letting items pile up.
+//
+// By Steven Chen
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+template<typename T> class SpscRing
+{
+public:
+  // one slot is kept empty to tell full from empty
+  explicit SpscRing(size_t capacity) : slots(capacity > 0 ? capacity+1 : 2), head(0), tail(0), full_waits(0) {}
+
+  // Producer side: false when the ring is full
+  bool TryPush(const T& item)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t next = Next(t);
+    if (next == head.load(std::memory_order_acquire))
+      return false;
+    slots[t] = item;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: false when the ring is empty
+  bool TryPop(T& item)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    item = slots[h];
+    head.store(Next(h), std::memory_order_release);
+    return true;
+  }
+
+  void Push(const T& item)
+  {
+    if (TryPush(item))
+      return;
+    full_waits++; // read by the producer only
+    for (int spins = 0; !TryPush(item); spins++)
+      Backoff(spins);
+  }
+
+  void Pop(T& item)
+  {
+    for (int spins = 0; !TryPop(item); spins++)
+      Backoff(spins);
+  }
+
+  // Times Push found the ring full, read it once the producer is done
+  long FullWaits() const { return full_waits; }
+
+private:
+  size_t Next(size_t i) const { return i+1 == slots.size() ? 0 : i+1; }
+
+  // spin a little for short waits, then sleep so an idle stage does not hold a core
+  static void Backoff(int spins)
+  {
+    if (spins < 64)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  // padding keeps head and tail on cache lines of their own
+  std::vector<T> slots;
+  char pad0[64];
+  std::atomic<size_t> head; // next slot to pop, written by the consumer
+  char pad1[64];
+  std::atomic<size_t> tail; // next slot to push, written by the producer
+  char pad2[64];
+  long full_waits;
+};
+
+#endif // SPSC_RING_HPP
@@ -0,0 +1,72 @@
+// Instrumentation of the hot paths: scoped timers and counters recorded
+// per thread, exported as Chrome trace events (chrome://tracing or
+// Perfetto) and summed per stage into a table.
+// Only built with -DMYCV_TRACE: otherwise the MYCV_TRACE_* macros expand
+// to nothing, their arguments are not evaluated, and the functions below
+// have nothing to report. With it, recording still waits for TraceEnable.
+//
+// By Steven Chen
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <iostream>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+// Recording is off until enabled; turn it on and off between frames
+void TraceEnable(bool enable);
+bool TraceEnabled();
+// Drop every event recorded so far. Call it while no thread records.
+void TraceClear();
+
+// name must be a string literal (or live as long as the trace).
+// items: work done in the scope (pixels mostly), 0 when not counted.
+void TraceRecord(const char* name, int64 begin, int64 end, int64 items);
+void TraceCount(const char* name, int64 value);
+// Name of the calling thread in the trace, e.g. the stage it runs
+void TraceThreadName(const char* name);
+
+// Call these once the traced work is done (threads joined or idle): they
+// read every thread's events without the recording threads taking a lock,
+// so they must not run while any other thread still records. Each thread
+// keeps its last 256Ki events; older ones are overwritten and counted.
+// Events whose scope began before since (a cv::getTickCount value) are
+// left out of the summary.
+bool TraceWriteChrome(const std::string& path);
+void TracePrintSummary(std::ostream& os, int64 since=0);
+
+class TraceScope
+{
+public:
+  TraceScope(const char* name, int64 items=0) : name(name), items(items), begin(TraceEnabled() ? cv::getTickCount() : 0) {}
+  ~TraceScope()
+  {
+    if (begin)
+      TraceRecord(name, begin, cv::getTickCount(), items);
+  }
+
+private:
+  const char* name;
+  int64 items;
+  int64 begin;
+};
+
+#ifdef MYCV_TRACE
+  #define MYCV_TRACE_CONCAT_(a, b) a##b
+  #define MYCV_TRACE_CONCAT(a, b) MYCV_TRACE_CONCAT_(a, b)
+  // time the rest of the enclosing block
+  #define MYCV_TRACE_SCOPE(name, items) TraceScope MYCV_TRACE_CONCAT(trace_scope_, __LINE__)(name, items)
+  #define MYCV_TRACE_COUNT(name, value) do { if (TraceEnabled()) TraceCount(name, value); } while (0)
+  #define MYCV_TRACE_THREAD(name) TraceThreadName(name)
+  // a statement that only trace builds need, e.g. a counter update
+  #define MYCV_TRACE_ONLY(statement) statement
+#else
+  #define MYCV_TRACE_SCOPE(name, items) ((void)0)
+  #define MYCV_TRACE_COUNT(name, value) ((void)0)
+  #define MYCV_TRACE_THREAD(name) ((void)0)
+  #define MYCV_TRACE_ONLY(statement)
+#endif
+
+#endif // TRACE_HPP
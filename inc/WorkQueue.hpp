@@ -0,0 +1,62 @@
+// Bounded blocking queue between the stages of a pipeline of threads.
+// Push waits while the queue is full and Pop while it is empty, so a
+// fast stage cannot run ahead of a slow one by more than the capacity.
+// After Close, Pop drains what is left and then returns false.
+//
+// By Steven Chen
+
+#ifndef WORK_QUEUE_HPP
+#define WORK_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template<typename T> class WorkQueue
+{
+public:
+  explicit WorkQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+  // Returns false, without queueing the item, once the queue is closed
+  bool Push(const T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed)
+      return false;
+    items.push_back(item);
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Returns false when the queue is closed and empty
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = items.front();
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // No more items: the producers are done
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable not_empty, not_full;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+};
+
+#endif // WORK_QUEUE_HPP
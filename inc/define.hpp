@@ -1,8 +1,10 @@
+// The OpenCV implementations of the stages (cvtColor, blur, Sobel, Canny,
+// connectedComponents) are picked at run time now, see Backend.hpp
 
-// #define OCV_CVTCOLOR 1
+// libmycanny is built with -DMYCV_NO_HIGHGUI: MyCanny's debug windows are
+// left out, so HighGUI is not needed
+// #define MYCV_NO_HIGHGUI 1
 
-// #define OCV_BLUR 1
-// #define OCV_CANNY 1
-// #define OCV_SOBEL 1
-
-// #define OCV_LABCONN 1
+// Build with -DMYCV_TRACE to time the stages and kernels (Trace.hpp);
+// without it the MYCV_TRACE_* macros compile to nothing
+// #define MYCV_TRACE 1
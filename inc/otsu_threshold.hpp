@@ -0,0 +1,21 @@
+// Otsu's method for image thresholding.
+//
+// By Steven Chen
+
+#ifndef OTSU_THRESHOLD_HPP
+#define OTSU_THRESHOLD_HPP
+
+#include <opencv2/opencv.hpp>
+
+// src: input,  8-bits 1-channel gray image
+// dst: output, OTSU binary image, 8-bits 1-channel binary image
+// inv: output type, 0: P=(P>TH)?255:0;  1: P=(P>TH)?0:255;
+// Returns the threshold TH.
+int otsu_threshold (const cv::Mat& src, cv::Mat& dst, int inv=0);
+
+// Histogram of an 8-bits 1-channel gray image
+void otsu_histogram(const cv::Mat& src, int hist[256]);
+// Otsu threshold of a histogram, e.g. one kept from a previous frame
+int otsu_threshold_hist(const int hist[256]);
+
+#endif // OTSU_THRESHOLD_HPP
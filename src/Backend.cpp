@@ -0,0 +1,126 @@
+// Registry of the backends of every pipeline stage and the parser of
+// backend specs. The stages themselves are dispatched by CannyContext.
+//
+// By Steven Chen
+
+#include "Backend.hpp"
+
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+static const char* const stage_names[PIPE_STAGES] = { "gray", "denoise", "sobel", "canny", "label", "threshold" };
+static const char* const backend_names[BACKEND_COUNT] = { "auto", "scalar", "simd", "threaded", "opencv", "auto+opencv" };
+
+static const bool available[PIPE_STAGES][BACKEND_COUNT] = {
+  // auto  scalar simd   threaded opencv auto+opencv
+  { true,  true,  true,  false,   true,  true }, // gray
+  { true,  true,  true,  false,   true,  true }, // denoise
+  { true,  true,  true,  false,   true,  true }, // sobel
+  { true,  true,  true,  true,    true,  true }, // canny: threaded is the tiled mode
+  { true,  true,  false, true,    true,  true }, // label: threaded labels strips in parallel
+  { true,  false, false, true,    true,  true }, // threshold: otsu_threshold counts strips in parallel
+};
+
+static const Backend default_backends[PIPE_STAGES] = {
+  BACKEND_SIMD, BACKEND_SIMD, BACKEND_SIMD, BACKEND_SIMD, BACKEND_SCALAR, BACKEND_THREADED
+};
+
+const char* PipeStageName(PipeStage stage)
+{
+  return stage >= 0 && stage < PIPE_STAGES ? stage_names[stage] : "?";
+}
+
+const char* BackendName(Backend backend)
+{
+  return backend >= 0 && backend < BACKEND_COUNT ? backend_names[backend] : "?";
+}
+
+bool BackendAvailable(PipeStage stage, Backend backend)
+{
+  return stage >= 0 && stage < PIPE_STAGES && backend >= 0 && backend < BACKEND_COUNT && available[stage][backend];
+}
+
+bool BackendAutoCandidate(PipeStage stage, Backend auto_backend, Backend backend)
+{
+  if (BackendIsAuto(backend) || (backend == BACKEND_OPENCV && auto_backend != BACKEND_AUTO_OPENCV))
+    return false;
+  return BackendAvailable(stage, backend);
+}
+
+bool BackendIsAuto(Backend backend)
+{
+  return backend == BACKEND_AUTO || backend == BACKEND_AUTO_OPENCV;
+}
+
+void DefaultBackends(Backend backends[PIPE_STAGES])
+{
+  for (int s=0; s<PIPE_STAGES; s++)
+    backends[s] = default_backends[s];
+}
+
+bool ParseBackends(const string& spec, Backend backends[PIPE_STAGES], string& error)
+{
+  string entries = spec;
+  if (!spec.empty() && spec[0] == '@') {
+    ifstream file(spec.substr(1).c_str());
+    if (!file) {
+      error = "cannot read " + spec.substr(1);
+      return false;
+    }
+    ostringstream text;
+    text << file.rdbuf();
+    entries = text.str();
+  }
+  for (size_t i=0; i<entries.size(); i++) {
+    if (entries[i] == '#') // comment to the end of the line
+      while (i < entries.size() && entries[i] != '\n')
+        entries[i++] = ' ';
+    if (i < entries.size() && (entries[i] == ',' || entries[i] == '\t' || entries[i] == '\r' || entries[i] == '\n'))
+      entries[i] = ' ';
+  }
+
+  // parse into a copy, so that a bad spec changes nothing
+  Backend parsed[PIPE_STAGES];
+  for (int s=0; s<PIPE_STAGES; s++)
+    parsed[s] = backends[s];
+  istringstream words(entries);
+  string entry;
+  while (words >> entry) {
+    size_t eq = entry.find('=');
+    string stage_name = entry.substr(0, eq), backend_name = eq == string::npos ? "" : entry.substr(eq+1);
+    int stage = stage_name == "all" ? PIPE_STAGES : -1;
+    for (int s=0; s<PIPE_STAGES && stage < 0; s++)
+      if (stage_name == stage_names[s])
+        stage = s;
+    int backend = -1;
+    for (int b=0; b<BACKEND_COUNT && backend < 0; b++)
+      if (backend_name == backend_names[b])
+        backend = b;
+    if (stage < 0 || backend < 0) {
+      error = "unknown stage or backend: " + entry;
+      return false;
+    }
+    if (stage == PIPE_STAGES) {
+      for (int s=0; s<PIPE_STAGES; s++)
+        if (available[s][backend])
+          parsed[s] = (Backend)backend;
+    } else if (available[stage][backend]) {
+      parsed[stage] = (Backend)backend;
+    } else {
+      error = string("stage ") + stage_names[stage] + " has no " + backend_names[backend] + " backend";
+      return false;
+    }
+  }
+  for (int s=0; s<PIPE_STAGES; s++)
+    backends[s] = parsed[s];
+  return true;
+}
+
+string BackendsString(const Backend backends[PIPE_STAGES])
+{
+  string str;
+  for (int s=0; s<PIPE_STAGES; s++)
+    str += string(s ? "," : "") + stage_names[s] + "=" + BackendName(backends[s]);
+  return str;
+}
@@ -1,39 +1,210 @@
 // Box Filter: all filter element are 1. average all neighber pixels.
+//   col_sum keeps, for every column, the sum of the 2r+1 rows of the
+//   window; moving down one row adds the entering row and subtracts the
+//   leaving one. Every output row is then a running sum along col_sum.
+//   Both steps cost O(1) per pixel, whatever the radius.
+//   The window rows are copied into a ring of 2r+1 rows, so dst may be src.
+//   The division by the window area is a float multiply by the reciprocal
+//   plus one exact correction step (all values stay below 2^24).
 //
 // By Steven Chen
 
-#include <iostream>
+#include "MyFilter.hpp"
+
+#include <cstring>
+#include <vector>
 using namespace std;
 
 #include <opencv2/opencv.hpp>
 using namespace cv;
- 
-void BoxFilter(const Mat& src, Mat& dst)
+
+// col_sum[x] += add[x] - sub[x]
+static void UpdateColSum_Scalar(int* col_sum, const uchar* add, const uchar* sub, int x, int cols)
 {
-  // Duplicate boundary for image
-  Mat raster = Mat::zeros(src.rows+2, src.cols+2, src.type()); 
-  src.copyTo(raster(Rect(1, 1, src.cols, src.rows)));
-  raster.row(1).copyTo(raster.row(0));
-  raster.col(1).copyTo(raster.col(0));
-  raster.col(raster.cols-2).copyTo(raster.col(raster.cols-1));
-  raster.row(raster.rows-2).copyTo(raster.row(raster.rows-1));
-
-  // Average
-  unsigned int average;
-  int width = raster.cols;
-  int height = raster.rows;
-  for (int i = 1; i < height - 1; i++) {
-    for (int j = 1; j < width - 1; j++) {
-      average = 0;
-      for (int m = -1; m <= 1; m++) {
-        for (int n = -1; n <= 1; n++)
-          average += raster.at<uchar>(i+m, j+n);
-      }
-//       dst.at<uchar>(i-1, j-1) = average/9;
-      average -= raster.at<uchar>(i, j);
-      dst.at<uchar>(i-1, j-1) = average/8;
+  for (; x<cols; x++)
+    col_sum[x] += add[x] - sub[x];
+}
+
+// num/den rounded down, num >= 0
+static void DivideRow_Scalar(const int* sum, const uchar* center, uchar* dst, int x, int cols, int area, bool exclude_center)
+{
+  if (exclude_center) {
+    for (; x<cols; x++)
+      dst[x] = (uchar)((sum[x] - center[x]) / (area-1));
+  } else {
+    for (; x<cols; x++)
+      dst[x] = (uchar)((2*sum[x] + area) / (2*area));
+  }
+}
+
+#ifdef MYCV_X86
+static void UpdateColSum_SSE2(int* col_sum, const uchar* add, const uchar* sub, int cols)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(add+x));
+    __m128i s = _mm_loadu_si128((const __m128i*)(sub+x));
+    __m128i d0 = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+    __m128i d1 = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+    // sign extend to 32 bits
+    __m128i d[4] = { _mm_srai_epi32(_mm_unpacklo_epi16(d0, d0), 16), _mm_srai_epi32(_mm_unpackhi_epi16(d0, d0), 16),
+                     _mm_srai_epi32(_mm_unpacklo_epi16(d1, d1), 16), _mm_srai_epi32(_mm_unpackhi_epi16(d1, d1), 16) };
+    for (int i=0; i<4; i++) {
+      __m128i* p = (__m128i*)(col_sum+x+4*i);
+      _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), d[i]));
     }
   }
+  UpdateColSum_Scalar(col_sum, add, sub, x, cols);
+}
+
+// 4 quotients num/den, exact for num < 2^24
+static inline __m128i Divide4_SSE2(__m128i num, __m128 den, __m128 inv)
+{
+  __m128 nf = _mm_cvtepi32_ps(num);
+  __m128i q = _mm_cvttps_epi32(_mm_mul_ps(nf, inv));
+  __m128 rem = _mm_sub_ps(nf, _mm_mul_ps(_mm_cvtepi32_ps(q), den));
+  q = _mm_sub_epi32(q, _mm_castps_si128(_mm_cmpge_ps(rem, den)));
+  return _mm_add_epi32(q, _mm_castps_si128(_mm_cmplt_ps(rem, _mm_setzero_ps())));
 }
- 
 
+static void DivideRow_SSE2(const int* sum, const uchar* center, uchar* dst, int cols, int area, bool exclude_center)
+{
+  const int den = exclude_center ? area-1 : 2*area;
+  const __m128 den_f = _mm_set1_ps((float)den), inv = _mm_set1_ps(1.f/den);
+  const __m128i half = _mm_set1_epi32(area), zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m128i q[4];
+    __m128i c = _mm_loadu_si128((const __m128i*)(center+x));
+    __m128i c16[2] = { _mm_unpacklo_epi8(c, zero), _mm_unpackhi_epi8(c, zero) };
+    for (int i=0; i<4; i++) {
+      __m128i n = _mm_loadu_si128((const __m128i*)(sum+x+4*i));
+      if (exclude_center)
+        n = _mm_sub_epi32(n, (i & 1) ? _mm_unpackhi_epi16(c16[i>>1], zero) : _mm_unpacklo_epi16(c16[i>>1], zero));
+      else
+        n = _mm_add_epi32(_mm_add_epi32(n, n), half);
+      q[i] = Divide4_SSE2(n, den_f, inv);
+    }
+    _mm_storeu_si128((__m128i*)(dst+x), _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+  }
+  DivideRow_Scalar(sum, center, dst, x, cols, area, exclude_center);
+}
+
+MYCV_TARGET_AVX2
+static void UpdateColSum_AVX2(int* col_sum, const uchar* add, const uchar* sub, int cols)
+{
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(add+x))),
+                                 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(sub+x))));
+    __m256i* p0 = (__m256i*)(col_sum+x);
+    __m256i* p1 = (__m256i*)(col_sum+x+8);
+    _mm256_storeu_si256(p0, _mm256_add_epi32(_mm256_loadu_si256(p0), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(d))));
+    _mm256_storeu_si256(p1, _mm256_add_epi32(_mm256_loadu_si256(p1), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(d, 1))));
+  }
+  UpdateColSum_Scalar(col_sum, add, sub, x, cols);
+}
+#endif
+
+static void UpdateColSum(int* col_sum, const uchar* add, const uchar* sub, int cols, SimdPath simd)
+{
+  switch (simd) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: UpdateColSum_AVX2(col_sum, add, sub, cols); break;
+    case SIMD_SSE2: UpdateColSum_SSE2(col_sum, add, sub, cols); break;
+#endif
+    default:        UpdateColSum_Scalar(col_sum, add, sub, 0, cols); break;
+  }
+}
+
+static void DivideRow(const int* sum, const uchar* center, uchar* dst, int cols, int area, bool exclude_center, SimdPath simd)
+{
+#ifdef MYCV_X86
+  // the float division is exact while the numerator 2*sum+area stays below 2^24
+  if (simd != SIMD_NONE && (2*255+1)*(int64)area < (1 << 24)) {
+    DivideRow_SSE2(sum, center, dst, cols, area, exclude_center);
+    return;
+  }
+#endif
+  DivideRow_Scalar(sum, center, dst, 0, cols, area, exclude_center);
+}
+
+void BoxFilter(const Mat& src, Mat& dst, int radius, bool exclude_center, FilterBuf& buf, SimdPath simd,
+               const FilterBorder& border)
+{
+  CV_Assert(src.type() == CV_8UC1);
+  CV_Assert(radius >= (exclude_center ? 1 : 0));
+  MYCV_TRACE_SCOPE("box", (int64)src.total());
+  dst.create(src.size(), CV_8UC1);
+  const int rows = src.rows, cols = src.cols;
+  if (rows == 0 || cols == 0)
+    return;
+  const int win = 2*radius + 1;
+  const int area = win*win;
+  simd = ResolveSimdPath(simd);
+
+  // window rows, row k (may be outside the image) lives in slot (k+radius)%win
+  Mat& ring = buf.box_ring;
+  buf.Create(ring, win, cols, CV_8UC1);
+  buf.Resize(buf.zeros, cols);
+  // radius columns of border on each side, +1 read by the last running sum step
+  buf.Resize(buf.col_sum, cols + 2*radius + 1);
+  buf.Resize(buf.row_sum, cols);
+  memset(&buf.zeros[0], 0, cols);
+  memset(&buf.col_sum[0], 0, buf.col_sum.size()*sizeof(int));
+  const uchar* zeros = &buf.zeros[0];
+  int* col_sum = &buf.col_sum[radius];
+  int* row_sum = &buf.row_sum[0];
+  const uchar* constant_row = 0;
+  if (border.type == BORDER_CONSTANT) {
+    buf.Resize(buf.border_row, cols);
+    memset(&buf.border_row[0], border.value, cols);
+    constant_row = &buf.border_row[0];
+  }
+
+  for (int k=-radius; k<=radius; k++) {
+    uchar* slot = ring.ptr<uchar>((k+radius) % win);
+    memcpy(slot, border.Row(src, k, constant_row), cols);
+    UpdateColSum(col_sum, slot, zeros, cols, simd);
+  }
+
+  for (int y=0; y<rows; y++) {
+    // border columns: the column sums of the source columns they map to
+    for (int k=1; k<=radius; k++) {
+      int left = border.Index(-k, cols), right = border.Index(cols-1+k, cols);
+      col_sum[-k] = left < 0 ? win*border.value : col_sum[left];
+      col_sum[cols-1+k] = right < 0 ? win*border.value : col_sum[right];
+    }
+    int s = 0;
+    for (int k=-radius; k<=radius; k++)
+      s += col_sum[k];
+    for (int x=0; x<cols; x++) {
+      row_sum[x] = s;
+      s += col_sum[x+radius+1] - col_sum[x-radius];
+    }
+    DivideRow(row_sum, ring.ptr<uchar>((y+radius) % win), dst.ptr<uchar>(y), cols, area, exclude_center, simd);
+
+    if (y+1 < rows) {
+      // row y-radius leaves the window, row y+radius+1 (not yet overwritten) enters;
+      // below the image it maps to a row of the window, taken from the ring
+      // as src may be dst
+      uchar* slot = ring.ptr<uchar>(y % win);
+      int k = y+radius+1, i = border.Index(k, rows);
+      const uchar* next = i < 0 ? constant_row : k < rows ? src.ptr<uchar>(k) : ring.ptr<uchar>((i+radius) % win);
+      UpdateColSum(col_sum, next, slot, cols, simd);
+      memcpy(slot, next, cols);
+    }
+  }
+}
+
+void BoxFilter(const Mat& src, Mat& dst, int radius, bool exclude_center, SimdPath simd, const FilterBorder& border)
+{
+  FilterBuf buf;
+  BoxFilter(src, dst, radius, exclude_center, buf, simd, border);
+}
+
+void BoxFilter(const Mat& src, Mat& dst)
+{
+  BoxFilter(src, dst, 1, true);
+}
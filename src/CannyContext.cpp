@@ -0,0 +1,295 @@
+// Canny edge detection and connected components pipeline with state.
+//   SetImage runs the stages that only depend on the frame: gray, median
+//   and box filters, Otsu threshold and the binary image's components.
+//   Detect labels the edges of MyCanny, split in two: the NMS map is
+//   memoized on the frame and the options it depends on, so a new
+//   threshold pair only runs hysteresis. With sorted_candidates the map's
+//   pixels are also sorted by magnitude once, and hysteresis only visits
+//   the candidates above the low threshold. Every stage writes into
+//   buffers of the context, which the first frame sizes and the following
+//   frames reuse; Allocations() counts the times one had to grow.
+//   Every stage is dispatched on its backend. An auto stage is tuned on
+//   the first frame of a size among its own backends, which give the same
+//   output (BackendAutoCandidate), auto+opencv adds opencv: each candidate
+//   runs twice on the frame and its faster run counts, the fastest
+//   candidate is kept until the frame size, type or auto kind changes.
+//   Sobel is tuned on the NMS map, then Canny on the whole detection with
+//   the Sobel that won.
+//
+// By Steven Chen
+
+#include "define.hpp"
+#include "CannyContext.hpp"
+#include "otsu_threshold.hpp"
+
+#include <cfloat>
+#include <iostream>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+CannyContext::CannyContext() :
+  rgb(false), median_radius(1), box_radius(0), connectivity(8), label_threads(0), edge_runs(false),
+  sorted_candidates(false), otsu_value(0), num_binary_objects(0), num_edge_objects(0),
+  smoothed_rgb(false), smoothed_median_radius(0), smoothed_box_radius(0), frame_id(0), nms_frame_id(-1), nms_sorted(false),
+  tuned_type(-1)
+{
+  DefaultBackends(backends);
+  for (int s=0; s<PIPE_STAGES; s++) {
+    selected[s] = tuned[s] = tuned_by[s] = BACKEND_AUTO;
+    for (int b=0; b<BACKEND_COUNT; b++)
+      tune_ms[s][b] = 0;
+  }
+}
+
+void CannyContext::SetImage(const Mat& image)
+{
+  MYCV_TRACE_SCOPE("set image", (int64)image.total());
+  src = image;
+  Smooth();
+}
+
+// The backend of stage for this frame: the one asked for, or with
+// an auto one the fastest candidate of run on the first frame of a size
+Backend CannyContext::Select(PipeStage stage, const function<void(Backend)>& run)
+{
+  Backend backend = backends[stage];
+  CV_Assert(BackendAvailable(stage, backend));
+  if (BackendIsAuto(backend)) {
+    if (tuned[stage] == BACKEND_AUTO || tuned_by[stage] != backend) {
+      tuned[stage] = Tune(stage, backend, run);
+      tuned_by[stage] = backend;
+    }
+    backend = tuned[stage];
+  }
+  selected[stage] = backend;
+  return backend;
+}
+
+Backend CannyContext::Tune(PipeStage stage, Backend auto_backend, const function<void(Backend)>& run)
+{
+#ifdef MYCV_TRACE
+  static const char* const tune_names[PIPE_STAGES] = {
+    "tune gray", "tune denoise", "tune sobel", "tune canny", "tune label", "tune threshold"
+  };
+  MYCV_TRACE_SCOPE(tune_names[stage], 0);
+#endif
+  nms_frame_id = -1; // the Sobel and Canny candidates overwrite the NMS map
+  Backend best = BACKEND_AUTO;
+  for (int b=BACKEND_AUTO+1; b<BACKEND_COUNT; b++) {
+    tune_ms[stage][b] = 0;
+    if (!BackendAutoCandidate(stage, auto_backend, (Backend)b))
+      continue;
+    double ms = DBL_MAX;
+    for (int rep=0; rep<2; rep++) { // the first run may size buffers
+      int64 t0 = getTickCount();
+      run((Backend)b);
+      ms = min(ms, (getTickCount() - t0) * 1000. / getTickFrequency());
+    }
+    tune_ms[stage][b] = ms;
+    if (best == BACKEND_AUTO || ms < tune_ms[stage][best])
+      best = (Backend)b;
+  }
+  return best;
+}
+
+SimdPath CannyContext::StageSimd(Backend backend) const
+{
+  return backend == BACKEND_SCALAR ? SIMD_NONE : canny_opts.simd;
+}
+
+// canny_opts for own Sobel and Canny backends
+CannyOptions CannyContext::StageOptions(Backend sobel, Backend canny) const
+{
+  CannyOptions opts = canny_opts;
+  opts.exec = canny == BACKEND_THREADED ? CANNY_EXEC_TILED : CANNY_EXEC_SERIAL;
+  opts.simd = StageSimd(canny);
+  opts.sobel = sobel == BACKEND_OPENCV ? CANNY_SOBEL_OPENCV : CANNY_SOBEL_MY;
+  opts.sobel_simd = StageSimd(sobel);
+  return opts;
+}
+
+void CannyContext::Gray(Backend backend)
+{
+  if (backend != BACKEND_OPENCV || src.type() == CV_8UC1) {
+    MyColorToGray(src, gray, rgb, StageSimd(backend)); // a gray src is shared, not copied
+    return;
+  }
+  MYCV_TRACE_SCOPE("gray opencv", (int64)src.total());
+  const int cn = src.channels();
+  int code = cn == 3 ? (rgb ? COLOR_RGB2GRAY : COLOR_BGR2GRAY) : (rgb ? COLOR_RGBA2GRAY : COLOR_BGRA2GRAY);
+  if (src.depth() == CV_8U) {
+    cvtColor(src, gray, code);
+  } else if (cn == 1) {
+    src.convertTo(gray, CV_8U, 1./256);
+  } else {
+    frame_buf.Create(gray16, src.rows, src.cols, CV_16UC1);
+    cvtColor(src, gray16, code);
+    gray16.convertTo(gray, CV_8U, 1./256);
+  }
+}
+
+void CannyContext::Denoise(Backend backend)
+{
+  if (backend == BACKEND_OPENCV) {
+    MYCV_TRACE_SCOPE("denoise opencv", (int64)gray.total());
+    if (median_radius > 0)
+      medianBlur(gray, smoothed, 2*median_radius+1);
+    else
+      gray.copyTo(smoothed);
+    int k = box_radius > 0 ? 2*box_radius+1 : 3; // blur has no 8-neighbour average, the centre is kept
+    blur(smoothed, smoothed, Size(k, k), Point(-1,-1), BORDER_REPLICATE);
+    return;
+  }
+  SimdPath simd = StageSimd(backend);
+  MedianFilter(gray, smoothed, median_radius, filter_buf, simd); // remove noise
+  if (box_radius > 0)
+    BoxFilter(smoothed, smoothed, box_radius, false, filter_buf, simd); // average
+  else
+    BoxFilter(smoothed, smoothed, 1, true, filter_buf, simd); // average of the 8 neighbours
+}
+
+void CannyContext::Threshold(Backend backend)
+{
+  MYCV_TRACE_SCOPE(backend == BACKEND_OPENCV ? "threshold opencv" : "threshold", (int64)smoothed.total());
+  if (backend == BACKEND_OPENCV)
+    otsu_value = (int)threshold(smoothed, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+  else
+    otsu_value = otsu_threshold(smoothed, binary);
+}
+
+void CannyContext::LabelBinary(Backend backend)
+{
+  MYCV_TRACE_SCOPE(backend == BACKEND_OPENCV ? "label binary opencv" : "label binary", (int64)binary.total());
+  if (backend == BACKEND_OPENCV)
+    num_binary_objects = connectedComponents(binary, binary_labels, connectivity, CV_32S);
+  else
+    num_binary_objects = LabelConnected(binary, binary_labels, binary_label_buf, connectivity,
+                                        backend == BACKEND_THREADED ? label_threads : 1);
+}
+
+void CannyContext::LabelEdges(Backend backend)
+{
+  MYCV_TRACE_SCOPE(backend == BACKEND_OPENCV && !edge_runs ? "label edges opencv" : "label edges", (int64)edges.total());
+  if (edge_runs) {
+    num_edge_objects = LabelRuns(edges, edge_labels, edge_label_buf, connectivity);
+    edge_stats.release();
+    edge_centroids.release();
+  } else if (backend == BACKEND_OPENCV) {
+    // no LABEL_STAT_PERIMETER column
+    num_edge_objects = connectedComponentsWithStats(edges, edge_labels, edge_stats, edge_centroids, connectivity, CV_32S);
+  } else {
+    num_edge_objects = LabelConnectedWithStats(edges, edge_labels, edge_stats, edge_centroids, edge_label_buf,
+                                               connectivity, backend == BACKEND_THREADED ? label_threads : 1);
+  }
+}
+
+void CannyContext::Smooth()
+{
+  // a new kind of frame is tuned again
+  if (src.size() != tuned_size || src.type() != tuned_type) {
+    for (int s=0; s<PIPE_STAGES; s++)
+      tuned[s] = BACKEND_AUTO;
+    tuned_size = src.size();
+    tuned_type = src.type();
+  }
+
+  // Convert the image to grayscale, a gray src is shared (not copied).
+  // gray must not keep sharing an earlier gray frame: the next color frame
+  // of its size would be converted into the caller's image.
+  if (src.type() != CV_8UC1) {
+    frame_buf.Create(gray_buf, src.rows, src.cols, CV_8UC1);
+    gray = gray_buf;
+  } else {
+    gray.release();
+  }
+  Gray(Select(PIPE_GRAY, [this](Backend b) { Gray(b); }));
+
+  /// Reduce noise, into smoothed so that a shared gray src is kept
+  frame_buf.Create(smoothed, src.rows, src.cols, CV_8UC1);
+  Denoise(Select(PIPE_DENOISE, [this](Backend b) { Denoise(b); }));
+
+  // connected components of the gray threshold image
+  frame_buf.Create(binary, src.rows, src.cols, CV_8UC1);
+  Threshold(Select(PIPE_THRESHOLD, [this](Backend b) { Threshold(b); }));
+  LabelBinary(Select(PIPE_LABEL, [this](Backend b) { LabelBinary(b); }));
+
+  smoothed_rgb = rgb;
+  smoothed_median_radius = median_radius;
+  smoothed_box_radius = box_radius;
+  frame_id++;
+}
+
+// The NMS map depends on the smoothed frame and the options up to NMS
+bool CannyContext::NmsValid(const CannyOptions& opts) const
+{
+  return nms_frame_id == frame_id && nms_opts.L2gradient == opts.L2gradient &&
+         nms_opts.mag_depth == opts.mag_depth && nms_opts.nms == opts.nms && nms_opts.sobel == opts.sobel &&
+         nms_opts.border == opts.border &&
+         (!sorted_candidates || nms_sorted);
+}
+
+void CannyContext::Detect(int lo_threshold, int hi_threshold)
+{
+  CV_Assert(!src.empty());
+  MYCV_TRACE_SCOPE("detect", (int64)src.total());
+  if (rgb != smoothed_rgb || median_radius != smoothed_median_radius || box_radius != smoothed_box_radius)
+    Smooth();
+
+  // Sobel is tuned on the NMS map with the own Canny asked for (SIMD if
+  // none), then Canny on the whole detection with the Sobel that won
+  Backend nms_canny = BackendIsAuto(backends[PIPE_CANNY]) || backends[PIPE_CANNY] == BACKEND_OPENCV ?
+                      BACKEND_SIMD : backends[PIPE_CANNY];
+  Backend sobel = Select(PIPE_SOBEL, [&](Backend b) {
+    MyCannyNms(smoothed, nms, StageOptions(b, nms_canny), canny_buf);
+  });
+  Backend canny = Select(PIPE_CANNY, [&](Backend b) {
+    frame_buf.Create(map_edges, smoothed.rows, smoothed.cols, CV_8UC1);
+    if (b == BACKEND_OPENCV) {
+      Canny(smoothed, map_edges, lo_threshold, hi_threshold, 3, canny_opts.L2gradient);
+    } else {
+      CannyOptions opts = StageOptions(sobel, b);
+      MyCannyNms(smoothed, nms, opts, canny_buf);
+      MyCannyHysteresis(nms, map_edges, lo_threshold, hi_threshold, opts, canny_buf);
+    }
+  });
+
+  if (canny == BACKEND_OPENCV) {
+    MYCV_TRACE_SCOPE("canny opencv", (int64)smoothed.total());
+    const int kernel_size = 3;
+    frame_buf.Create(map_edges, smoothed.rows, smoothed.cols, CV_8UC1);
+    Canny(smoothed, map_edges, lo_threshold, hi_threshold, kernel_size, canny_opts.L2gradient);
+    edges = map_edges;
+  } else {
+    CannyOptions opts = StageOptions(sobel, canny);
+    if (!NmsValid(opts)) {
+      MYCV_TRACE_SCOPE("nms map", (int64)smoothed.total());
+      MyCannyNms(smoothed, nms, opts, canny_buf);
+      if (sorted_candidates)
+        MyCannySortCandidates(nms, candidates);
+      nms_frame_id = frame_id;
+      nms_opts = opts;
+      nms_sorted = sorted_candidates;
+    }
+    if (sorted_candidates) {
+      MYCV_TRACE_SCOPE("hysteresis", (int64)smoothed.total());
+      MyCannyHysteresis(nms, candidates, lo_threshold, hi_threshold, opts.hysteresis);
+      edges = candidates.edges;
+    } else {
+      MYCV_TRACE_SCOPE("hysteresis", (int64)smoothed.total());
+      frame_buf.Create(map_edges, smoothed.rows, smoothed.cols, CV_8UC1);
+      MyCannyHysteresis(nms, map_edges, lo_threshold, hi_threshold, opts, canny_buf);
+      edges = map_edges;
+    }
+  }
+
+  // the label backend was selected on the binary image
+  LabelEdges(Select(PIPE_LABEL, [this](Backend b) { LabelBinary(b); }));
+}
+
+long CannyContext::Allocations() const
+{
+  return frame_buf.allocations + filter_buf.allocations + canny_buf.allocations + candidates.allocations +
+         edge_label_buf.allocations + binary_label_buf.allocations;
+}
@@ -0,0 +1,179 @@
+// libmycanny's public API (CannyLib.hpp) on top of the pipeline functions.
+//
+// By Steven Chen
+
+#include "CannyLib.hpp"
+#include "MyCanny.hpp"
+#include "MyFilter.hpp"
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+#include "otsu_threshold.hpp"
+
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+using namespace cv;
+
+namespace mycv {
+
+struct Workspace::Impl {
+  ScratchBuf frame_buf; // gray, smoothed
+  Mat gray, smoothed; // gray of a color frame only
+  FilterBuf filter_buf;
+  CannyBuf canny_buf;
+  LabelBuf label_buf;
+  std::vector<short> sobel_buf;
+};
+
+// An output view must take the result in place: a cv::Mat header of the
+// right size and type is never reallocated
+static void CheckView(const ImageView& view, const Mat& result)
+{
+  CV_Assert(result.data == view.data);
+}
+
+// The output header over a view; its size and type are checked by the call
+static Mat OutputView(const ImageView& view, const ImageView& like, int type)
+{
+  CV_Assert(view.width == like.width && view.height == like.height && view.type == type);
+  return view.AsMat();
+}
+
+Workspace::Workspace() : p(new Impl)
+{
+}
+
+Workspace::~Workspace()
+{
+  delete p;
+}
+
+long Workspace::Allocations() const
+{
+  return p->frame_buf.allocations + p->filter_buf.allocations + p->canny_buf.allocations + p->label_buf.allocations;
+}
+
+void Canny(const Mat& src, Mat& edges, const CannyParams& params, Workspace& ws)
+{
+  CV_Assert(params.median_radius >= 0 && params.box_radius >= 0 && params.num_threads >= 0);
+  Workspace::Impl& w = ws.impl();
+  FilterBorder border(params.border, params.border_value);
+
+  // a gray src is shared, not copied, and never kept in ws: the next color
+  // frame of its size would be converted into the caller's image
+  Mat gray;
+  if (src.type() != CV_8UC1) {
+    w.frame_buf.Create(w.gray, src.rows, src.cols, CV_8UC1);
+    gray = w.gray;
+  }
+  MyColorToGray(src, gray, params.rgb);
+
+  w.frame_buf.Create(w.smoothed, src.rows, src.cols, CV_8UC1);
+  MedianFilter(gray, w.smoothed, params.median_radius, w.filter_buf, SIMD_AUTO, border);
+  if (params.box_radius > 0)
+    BoxFilter(w.smoothed, w.smoothed, params.box_radius, false, w.filter_buf, SIMD_AUTO, border);
+  else
+    BoxFilter(w.smoothed, w.smoothed, 1, true, w.filter_buf, SIMD_AUTO, border);
+
+  CannyOptions opts;
+  opts.L2gradient = params.L2gradient;
+  opts.border = border;
+  if (params.num_threads != 1) {
+    opts.exec = CANNY_EXEC_TILED;
+    opts.num_threads = params.num_threads;
+  }
+  MyCanny(w.smoothed, edges, params.low_threshold, params.high_threshold, opts, w.canny_buf);
+}
+
+void Canny(const ImageView& src, const ImageView& edges, const CannyParams& params, Workspace& ws)
+{
+  Mat dst = OutputView(edges, src, CV_8UC1);
+  Canny(src.AsMat(), dst, params, ws);
+  CheckView(edges, dst);
+}
+
+void Median(const Mat& src, Mat& dst, int radius, Workspace& ws, int border, uchar border_value)
+{
+  MedianFilter(src, dst, radius, ws.impl().filter_buf, SIMD_AUTO, FilterBorder(border, border_value));
+}
+
+void Median(const ImageView& src, const ImageView& dst, int radius, Workspace& ws, int border, uchar border_value)
+{
+  Mat out = OutputView(dst, src, CV_8UC1);
+  Median(src.AsMat(), out, radius, ws, border, border_value);
+  CheckView(dst, out);
+}
+
+void Box(const Mat& src, Mat& dst, int radius, Workspace& ws, int border, uchar border_value)
+{
+  CV_Assert(radius >= 0);
+  BoxFilter(src, dst, max(radius, 1), radius == 0, ws.impl().filter_buf, SIMD_AUTO, FilterBorder(border, border_value));
+}
+
+void Box(const ImageView& src, const ImageView& dst, int radius, Workspace& ws, int border, uchar border_value)
+{
+  Mat out = OutputView(dst, src, CV_8UC1);
+  Box(src.AsMat(), out, radius, ws, border, border_value);
+  CheckView(dst, out);
+}
+
+void Sobel(const Mat& src, Mat& grad_x, Mat& grad_y, Workspace& ws, int border, uchar border_value)
+{
+  CV_Assert(src.type() == CV_8UC1);
+  Workspace::Impl& w = ws.impl();
+  w.frame_buf.Resize(w.sobel_buf, MySobelBufSize(src.cols));
+  MySobelRows(src, grad_x, grad_y, 0, src.rows, &w.sobel_buf[0], SIMD_AUTO, FilterBorder(border, border_value));
+}
+
+void Sobel(const ImageView& src, const ImageView& grad_x, const ImageView& grad_y, Workspace& ws,
+           int border, uchar border_value)
+{
+  Mat gx = OutputView(grad_x, src, CV_16SC1), gy = OutputView(grad_y, src, CV_16SC1);
+  Sobel(src.AsMat(), gx, gy, ws, border, border_value);
+  CheckView(grad_x, gx);
+  CheckView(grad_y, gy);
+}
+
+int Label(const Mat& img, Mat& labels, Workspace& ws, int connectivity, int num_threads)
+{
+  return LabelConnected(img, labels, ws.impl().label_buf, connectivity, num_threads, CV_32S);
+}
+
+int Label(const ImageView& img, const ImageView& labels, Workspace& ws, int connectivity, int num_threads)
+{
+  Mat out = OutputView(labels, img, CV_32SC1);
+  int num_objects = Label(img.AsMat(), out, ws, connectivity, num_threads);
+  CheckView(labels, out);
+  return num_objects;
+}
+
+int Label(const Mat& img, Mat& labels, Mat& stats, Mat& centroids, Workspace& ws, int connectivity, int num_threads)
+{
+  return LabelConnectedWithStats(img, labels, stats, centroids, ws.impl().label_buf, connectivity, num_threads, CV_32S);
+}
+
+int Label(const ImageView& img, const ImageView& labels, Mat& stats, Mat& centroids, Workspace& ws,
+          int connectivity, int num_threads)
+{
+  Mat out = OutputView(labels, img, CV_32SC1);
+  int num_objects = Label(img.AsMat(), out, stats, centroids, ws, connectivity, num_threads);
+  CheckView(labels, out);
+  return num_objects;
+}
+
+int Otsu(const Mat& gray, Mat& binary, bool invert)
+{
+  CV_Assert(gray.type() == CV_8UC1);
+  return otsu_threshold(gray, binary, invert ? 1 : 0);
+}
+
+int Otsu(const ImageView& gray, const ImageView& binary, bool invert)
+{
+  Mat out = OutputView(binary, gray, CV_8UC1);
+  int threshold = Otsu(gray.AsMat(), out, invert);
+  CheckView(binary, out);
+  return threshold;
+}
+
+} // namespace mycv
@@ -0,0 +1,166 @@
+/*
+  Topic: Gradient's magnitude for Canny Edge Detection
+
+ * @function GradMagnitude
+ *   L2: round(sqrt(gx*gx + gy*gy)), integer-exact. The sum of squares is
+ *       computed in 32-bit lanes (pmaddwd), the float sqrt only gives a
+ *       first guess r which is then corrected with r*r-r < n <= r*r+r.
+ *   L1: (|gx| + |gy|) / 2, round half to even. For 8-bit output every
+ *       component is saturated first, as convertScaleAbs + addWeighted did.
+ *   Output depth CV_8U saturates at 255, CV_16U keeps the full range.
+
+  Author: Steven Chen
+*/
+
+#include "MyCanny.hpp"
+
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+// rounded integer square root, exact for 0 <= n < 2^24
+static inline int RoundSqrt(int n)
+{
+  int r = cvRound(std::sqrt((float)n));
+  if (n > r*r + r) r++;
+  else if (r > 0 && n <= r*r - r) r--;
+  return r;
+}
+
+template<typename MagT> static void MagnitudeRow_Scalar(const short* grad_x, const short* grad_y, MagT* grad_mag, int cols, bool L2gradient)
+{
+  const int max_val = (sizeof(MagT) == 1) ? 255 : 65535;
+  if (L2gradient) {
+    for (int x=0; x<cols; x++) {
+      int r = RoundSqrt(grad_x[x]*grad_x[x] + grad_y[x]*grad_y[x]);
+      grad_mag[x] = (MagT)min(r, max_val);
+    }
+  } else {
+    for (int x=0; x<cols; x++) {
+      int s = sizeof(MagT) == 1 ? min(abs(grad_x[x]), 255) + min(abs(grad_y[x]), 255) : abs(grad_x[x]) + abs(grad_y[x]);
+      grad_mag[x] = (MagT)((s + ((s>>1) & 1)) >> 1);
+    }
+  }
+}
+
+#ifdef MYCV_X86
+// 8 pixels of |gx|,|gy| -> 16-bit magnitude
+static inline __m128i Magnitude8_SSE2(__m128i gx, __m128i gy, bool L2gradient, bool sat8)
+{
+  if (L2gradient) {
+    __m128i n0 = _mm_madd_epi16(_mm_unpacklo_epi16(gx, gy), _mm_unpacklo_epi16(gx, gy));
+    __m128i n1 = _mm_madd_epi16(_mm_unpackhi_epi16(gx, gy), _mm_unpackhi_epi16(gx, gy));
+    __m128i r[2];
+    __m128i n[2] = { n0, n1 };
+    for (int i=0; i<2; i++) {
+      __m128i v = _mm_cvtps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(n[i])));
+      __m128i sq = _mm_madd_epi16(v, v); // v < 2^15, so the high halves are 0
+      __m128i up = _mm_cmpgt_epi32(n[i], _mm_add_epi32(sq, v));                 // n > r*r+r
+      __m128i dn = _mm_xor_si128(_mm_cmpgt_epi32(n[i], _mm_sub_epi32(sq, v)),   // n <= r*r-r
+                                 _mm_set1_epi32(-1));
+      r[i] = _mm_add_epi32(_mm_sub_epi32(v, up), dn);
+    }
+    // the n <= r*r-r test also fires for n == 0, clamp that back to 0
+    return _mm_max_epi16(_mm_packs_epi32(r[0], r[1]), _mm_setzero_si128());
+  }
+  __m128i ax = _mm_max_epi16(gx, _mm_sub_epi16(_mm_setzero_si128(), gx));
+  __m128i ay = _mm_max_epi16(gy, _mm_sub_epi16(_mm_setzero_si128(), gy));
+  if (sat8) {
+    ax = _mm_min_epi16(ax, _mm_set1_epi16(255));
+    ay = _mm_min_epi16(ay, _mm_set1_epi16(255));
+  }
+  __m128i s = _mm_add_epi16(ax, ay);
+  __m128i odd = _mm_and_si128(_mm_srli_epi16(s, 1), _mm_set1_epi16(1));
+  return _mm_srli_epi16(_mm_add_epi16(s, odd), 1);
+}
+
+template<typename MagT> static void MagnitudeRow_SSE2(const short* grad_x, const short* grad_y, MagT* grad_mag, int cols, bool L2gradient)
+{
+  const bool sat8 = sizeof(MagT) == 1;
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m128i m0 = Magnitude8_SSE2(_mm_loadu_si128((const __m128i*)(grad_x+x)), _mm_loadu_si128((const __m128i*)(grad_y+x)), L2gradient, sat8);
+    __m128i m1 = Magnitude8_SSE2(_mm_loadu_si128((const __m128i*)(grad_x+x+8)), _mm_loadu_si128((const __m128i*)(grad_y+x+8)), L2gradient, sat8);
+    if (sat8) {
+      _mm_storeu_si128((__m128i*)(grad_mag+x), _mm_packus_epi16(m0, m1));
+    } else {
+      _mm_storeu_si128((__m128i*)(grad_mag+x), m0);
+      _mm_storeu_si128((__m128i*)(grad_mag+x+8), m1);
+    }
+  }
+  MagnitudeRow_Scalar(grad_x+x, grad_y+x, grad_mag+x, cols-x, L2gradient);
+}
+
+// 16 pixels; unpack and pack both work inside 128-bit lanes, so the order is kept
+MYCV_TARGET_AVX2
+static inline __m256i Magnitude16_AVX2(__m256i gx, __m256i gy, bool L2gradient, bool sat8)
+{
+  if (L2gradient) {
+    __m256i lo = _mm256_unpacklo_epi16(gx, gy), hi = _mm256_unpackhi_epi16(gx, gy);
+    __m256i n[2] = { _mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi) };
+    __m256i r[2];
+    for (int i=0; i<2; i++) {
+      __m256i v = _mm256_cvtps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(n[i])));
+      __m256i sq = _mm256_madd_epi16(v, v);
+      __m256i up = _mm256_cmpgt_epi32(n[i], _mm256_add_epi32(sq, v));
+      __m256i dn = _mm256_xor_si256(_mm256_cmpgt_epi32(n[i], _mm256_sub_epi32(sq, v)), _mm256_set1_epi32(-1));
+      r[i] = _mm256_add_epi32(_mm256_sub_epi32(v, up), dn);
+    }
+    return _mm256_max_epi16(_mm256_packs_epi32(r[0], r[1]), _mm256_setzero_si256());
+  }
+  __m256i ax = _mm256_abs_epi16(gx), ay = _mm256_abs_epi16(gy);
+  if (sat8) {
+    ax = _mm256_min_epi16(ax, _mm256_set1_epi16(255));
+    ay = _mm256_min_epi16(ay, _mm256_set1_epi16(255));
+  }
+  __m256i s = _mm256_add_epi16(ax, ay);
+  __m256i odd = _mm256_and_si256(_mm256_srli_epi16(s, 1), _mm256_set1_epi16(1));
+  return _mm256_srli_epi16(_mm256_add_epi16(s, odd), 1);
+}
+
+template<typename MagT> MYCV_TARGET_AVX2
+static void MagnitudeRow_AVX2(const short* grad_x, const short* grad_y, MagT* grad_mag, int cols, bool L2gradient)
+{
+  const bool sat8 = sizeof(MagT) == 1;
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m256i m = Magnitude16_AVX2(_mm256_loadu_si256((const __m256i*)(grad_x+x)), _mm256_loadu_si256((const __m256i*)(grad_y+x)), L2gradient, sat8);
+    if (sat8)
+      _mm_storeu_si128((__m128i*)(grad_mag+x), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(m, m), 0x08)));
+    else
+      _mm256_storeu_si256((__m256i*)(grad_mag+x), m);
+  }
+  MagnitudeRow_Scalar(grad_x+x, grad_y+x, grad_mag+x, cols-x, L2gradient);
+}
+#endif
+
+template<typename MagT> static void MagnitudeRow(const short* grad_x, const short* grad_y, MagT* grad_mag, int cols, bool L2gradient, SimdPath simd)
+{
+  switch (ResolveSimdPath(simd)) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: MagnitudeRow_AVX2(grad_x, grad_y, grad_mag, cols, L2gradient); break;
+    case SIMD_SSE2: MagnitudeRow_SSE2(grad_x, grad_y, grad_mag, cols, L2gradient); break;
+#endif
+    default:        MagnitudeRow_Scalar(grad_x, grad_y, grad_mag, cols, L2gradient); break;
+  }
+}
+
+void GradMagnitudeRow(const short* grad_x, const short* grad_y, uchar* grad_mag, int cols, bool L2gradient, int depth, SimdPath simd)
+{
+  if (depth == CV_16U)
+    MagnitudeRow(grad_x, grad_y, (ushort*)grad_mag, cols, L2gradient, simd);
+  else
+    MagnitudeRow(grad_x, grad_y, grad_mag, cols, L2gradient, simd);
+}
+
+void GradMagnitude(const Mat& grad_x, const Mat& grad_y, Mat& grad_mag, bool L2gradient, int depth, SimdPath simd)
+{
+  CV_Assert(grad_x.type() == CV_16S && grad_y.type() == CV_16S && grad_x.size() == grad_y.size());
+  CV_Assert(depth == CV_8U || depth == CV_16U);
+  grad_mag.create(grad_x.size(), depth);
+  for (int y=0; y<grad_x.rows; y++)
+    GradMagnitudeRow(grad_x.ptr<short>(y), grad_y.ptr<short>(y), grad_mag.ptr<uchar>(y), grad_x.cols, L2gradient, depth, simd);
+}
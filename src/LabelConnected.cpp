@@ -1,15 +1,17 @@
 /* 
  * File: LabelConnected.cpp
  * Purpose: Label Connected Components
- *   - Implements the Union-Find labeling algorithm in serial.
- *   - Contains a Union-Find data structure to resolve equivalences between labels.
+ *   - Implements the Union-Find labeling algorithm, in serial or on
+ *     horizontal strips labeled in parallel.
+ *   - Resolves equivalences between labels with the Union-Find sets of LabelSets.hpp.
  */
 
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+
 #include <algorithm>
-#include <iostream>
 #include <utility>
 #include <vector>
-#include <map>
 #include <climits>
 
 using namespace std;
@@ -17,210 +19,467 @@ using namespace std;
 #include <opencv2/opencv.hpp>
 using namespace cv;
 
-static const uint ERROR_CODE = UINT_MAX - 1;
-static const uint OUT_COLOR = UINT_MAX - 1;
-
-// helps model a tree like structure where the parent node is the 
-// representative of an equivalence class 
-struct node { 
-    node *parent;
-    uint label;
-    node(uint label) { 
-        this->label = label;
-        this->parent = this;
-    }   
-};
 
-// get the root node (the representative) associated to a node 
-node *FindRoot(node *n)
-{ 
-  while (n->parent != n) 
-    n = n->parent;
-  return n;
+// Label of pixel x of a row below the first one (Wu's decision tree).
+// Neighbours of the same value: a b c (row above)
+//                               d x
+// b is a neighbour of a, c and d, so when b matches nothing else needs a
+// look. Otherwise c can join a or d, and a and d are neighbours of each
+// other. 4-connectivity only looks at b and d. has_left/has_right drop the
+// neighbours outside the image at compile time.
+template<uint connectivity, bool has_left, bool has_right, typename T>
+static inline T DecideLabel(const uchar* img_up, const uchar* img_row, const T* lab_up, const T* lab_row,
+                            int x, LabelSets& sets)
+{
+  const uchar v = img_row[x];
+  if (connectivity == 4) {
+    if (img_up[x] == v) {
+      if (has_left && img_row[x-1] == v)
+        return (T)sets.Union(lab_up[x], lab_row[x-1]);
+      return lab_up[x];
+    }
+    if (has_left && img_row[x-1] == v)
+      return lab_row[x-1];
+    return (T)sets.NewLabel();
+  }
+  if (img_up[x] == v)                       // b
+    return lab_up[x];
+  if (has_right && img_up[x+1] == v) {      // c
+    if (has_left && img_up[x-1] == v)       // c + a
+      return (T)sets.Union(lab_up[x+1], lab_up[x-1]);
+    if (has_left && img_row[x-1] == v)      // c + d
+      return (T)sets.Union(lab_up[x+1], lab_row[x-1]);
+    return lab_up[x+1];
+  }
+  if (has_left && img_up[x-1] == v)         // a
+    return lab_up[x-1];
+  if (has_left && img_row[x-1] == v)        // d
+    return lab_row[x-1];
+  return (T)sets.NewLabel();
 }
 
-//// set x as y's parents
-// Set smaller node as larger node's parents
-void Union(node *x, node *y)
-{ 
-  node *xRep = FindRoot(x);
-  node *yRep = FindRoot(y);
-  //cout << "Root of "<< x->label<<": "<<xRep->label<<endl;
-  //cout << "Root of "<< y->label<<": "<<yRep->label<<endl;
-  if (yRep->label > xRep->label)
-    yRep->parent = xRep;
-  else if (yRep->label < xRep->label)
-    xRep->parent = yRep;
+// First pass of the Union-Find labeling algorithm. Attributes labels
+// to zones in a forward manner (i.e. by looking only at a subset of the
+// neighbors). Every pixel of the same value as a neighbour joins it.
+// Only rows [y0, y1) are labeled, row y0 is taken as the first row.
+template<uint connectivity, typename T> void FirstPass(const Mat& img, Mat& labels, LabelSets& sets, int y0, int y1)
+{
+  int width  = img.cols;
+  if (width == 0 || y0 >= y1)
+    return;
+
+  // first row: only the left neighbour
+  const uchar* img_row = img.ptr<uchar>(y0);
+  T* lab_row = labels.ptr<T>(y0);
+  lab_row[0] = (T)sets.NewLabel();
+  for (int x=1; x<width; x++)
+    lab_row[x] = (img_row[x-1] == img_row[x]) ? lab_row[x-1] : (T)sets.NewLabel();
+
+  for (int y=y0+1; y<y1; y++) {
+    const uchar* img_up = img_row;
+    const T* lab_up = lab_row;
+    img_row = img.ptr<uchar>(y);
+    lab_row = labels.ptr<T>(y);
+    if (width == 1) {
+      lab_row[0] = DecideLabel<connectivity, false, false, T>(img_up, img_row, lab_up, lab_row, 0, sets);
+      continue;
+    }
+    lab_row[0] = DecideLabel<connectivity, false, true, T>(img_up, img_row, lab_up, lab_row, 0, sets);
+    for (int x=1; x<width-1; x++)
+      lab_row[x] = DecideLabel<connectivity, true, true, T>(img_up, img_row, lab_up, lab_row, x, sets);
+    lab_row[width-1] = DecideLabel<connectivity, true, false, T>(img_up, img_row, lab_up, lab_row, width-1, sets);
+  }
+}
+
+
+// Most provisional labels rows [y0, y1) may need. A pixel only starts a
+// new label when it differs from its left neighbour, so 32-bit labels
+// count those run starts. 16-bit labels are capped at the CV_16U range.
+static uint CountRunStarts(const Mat& img, int y0, int y1)
+{
+  uint runs = 0;
+  for (int y=y0; y<y1; y++) {
+    const uchar* p = img.ptr<uchar>(y);
+    runs += (img.cols > 0);
+    for (int x=1; x<img.cols; x++)
+      runs += (p[x] != p[x-1]);
+  }
+  return runs;
 }
 
-// create a link between two labels, smaller label are parents
-void Union(uint lab1, uint lab2, map<uint, node *>& labToNode)
-{ 
-  node *x = labToNode[lab1];
-  node *y = labToNode[lab2];
-  //cout << "Union:"<<x->label<<" & "<< y->label<<endl;
-  Union(x, y);
+template<typename T> static uint LabelCapacity(const Mat& img, int y0, int y1)
+{
+  if (sizeof(T) == sizeof(ushort))
+    return (uint)min<size_t>((size_t)(y1-y0)*img.cols, USHRT_MAX+1);
+  return CountRunStarts(img, y0, y1);
 }
 
 
-// create new node for label (and add it to the map)
-void AddLabel(uint& label, map<uint, node *>& labToNode)
-{ 
-    node *toAdd = new node(label);
-    labToNode[label] = toAdd;
-    label++;
+// Second pass of the Union-Find labeling algorithm. Resolves 
+// the equivalences of labels through the flattened sets (a flat lookup
+// table), the final labels are already compact.
+// Modifies label by reference to avoid allocating extra memory. 
+// Rows [y0, y1) hold provisional labels counted from base.
+template<typename T> void SecondPass(const LabelSets& sets, Mat& labels, int y0, int y1, uint base=0) { 
+  const uint* lut = &sets.parent[base];
+  for (int i = y0; i < y1; i++) {
+    T* lab = labels.ptr<T>(i);
+    for (int j = 0; j < labels.cols; j++)
+      lab[j] = (T)lut[(uint)lab[j]];
+  }
 }
 
 
-// First pass of the Union-Find labeling algorithm. Attributes labels
-// to zones in a forward manner (i.e. by looking only at a subset of the
-// neighbors). 
-template<uint connectivity> void FirstPass(const Mat& img, Mat& labels, map<uint, node *>& labToNode, uint &currLabel)
+// Second pass that also sums up the objects' statistics. A run of equal
+// pixels in a row belongs to one object, so labels are resolved and
+// statistics counted once per run. Both ends of a run are on the object's
+// border, the pixels in between only when the pixel above or below
+// differs (or is outside the image).
+template<typename T> void SecondPass(const LabelSets& sets, const Mat& img, Mat& labels, int y0, int y1, uint base,
+                                     vector<ComponentStats>& stats) {
+  const uint* lut = &sets.parent[base];
+  const int width = labels.cols, last = img.rows-1;
+  for (int y = y0; y < y1; y++) {
+    const uchar* row = img.ptr<uchar>(y);
+    const uchar* up = img.ptr<uchar>(max(y-1, 0));
+    const uchar* down = img.ptr<uchar>(min(y+1, last));
+    const bool border_row = (y == 0 || y == last);
+    T* lab = labels.ptr<T>(y);
+    for (int x = 0; x < width; ) {
+      const uchar v = row[x];
+      int end = x+1;
+      while (end < width && row[end] == v)
+        end++;
+      const uint label = lut[(uint)lab[x]];
+      for (int i = x; i < end; i++)
+        lab[i] = (T)label;
+
+      const int len = end-x;
+      int border = min(len, 2);
+      if (border_row)
+        border = len;
+      else
+        for (int i = x+1; i < end-1; i++)
+          border += (up[i] != v || down[i] != v);
+
+      ComponentStats& st = stats[label];
+      st.left = min(st.left, x);
+      st.right = max(st.right, end-1);
+      st.top = min(st.top, y);
+      st.bottom = y;
+      st.area += len;
+      st.perimeter += border;
+      st.sum_x += (int64)len*(x+end-1)/2;
+      st.sum_y += (int64)len*y;
+      x = end;
+    }
+  }
+}
+
+
+// Parallel labeling on horizontal strips. Every strip runs the first pass
+// on its own, as if it was a whole image, with its own provisional labels.
+// The strip labels are then moved into one set of labels, strip s from
+// base[s] on: strips and labels within a strip are in raster order, so
+// the roots and the final labels come out as in the serial labeling.
+// The sets, offsets and statistics live in a LabelBuf.
+struct LabelStrips {
+  const Mat& img;
+  Mat& labels;
+  int strip_height;
+  LabelBuf& buf;
+  bool with_stats; // second pass with statistics
+  LabelStrips(const Mat& img, Mat& labels, int strip_height, LabelBuf& buf, bool with_stats) :
+    img(img), labels(labels), strip_height(strip_height), buf(buf), with_stats(with_stats) {}
+  int StripBegin(int s) const { return s*strip_height; }
+  int StripEnd(int s) const { return min((s+1)*strip_height, img.rows); }
+};
+
+template<uint connectivity, typename T> class FirstPassBody : public ParallelLoopBody
 {
-  int width  = img.cols;
-  int height = img.rows;
-
-  uint left, up, leftup, rightup, curr, currPos;
-  uint leftC, upC, leftupC, rightupC;
-
-  for (int y=0; y<height; y++) { 
-    for (int x=0; x<width; x++) { 
-      vector<uint> match; // initial match vector to 0 in each loop
-      leftC = (x == 0) ? OUT_COLOR : img.at<uchar>(y, x-1);
-      upC = (y == 0) ? OUT_COLOR : img.at<uchar>(y-1, x);
-      curr = img.at<uchar>(y, x);
-      if (leftC == curr) match.push_back(labels.at<ushort>(y, x-1));
-      if (upC == curr) match.push_back(labels.at<ushort>(y-1, x));
-
-      if (connectivity == 8) {
-        leftupC = (y==0 || x==0) ? OUT_COLOR : img.at<uchar>(y-1, x-1);
-        rightupC = (y==0 || (x==img.cols)) ? OUT_COLOR : img.at<uchar>(y-1, x+1);
-        if (leftupC == curr) match.push_back(labels.at<ushort>(y-1, x-1));
-        if (rightupC == curr) match.push_back(labels.at<ushort>(y-1, x+1));
-      }
+public:
+  FirstPassBody(LabelStrips& strips) : strips(strips) {}
+  void operator()(const Range& range) const
+  {
+    for (int s = range.start; s < range.end; s++) {
+      int y0 = strips.StripBegin(s), y1 = strips.StripEnd(s);
+      LabelSets& sets = strips.buf.strip_sets[s];
+      strips.buf.Resize(sets.parent, LabelCapacity<T>(strips.img, y0, y1));
+      sets.count = 0;
+      MYCV_TRACE_ONLY(sets.unions = 0);
+      FirstPass<connectivity, T>(strips.img, strips.labels, sets, y0, y1);
+    }
+  }
+private:
+  LabelStrips& strips;
+};
 
-      if (match.size() == 0) { // w/o any neighber connected
-        labels.at<ushort>(y, x) = currLabel; // assign a new label
-        AddLabel(currLabel, labToNode);  // and create a node struct
-      } else {
-        sort(match.begin(), match.end());
-        uint ref = match[0];
-        labels.at<ushort>(y, x) = ref; // according to neighber assign minimum label
-        for (int i = 1; i < (int)match.size(); i++) { // mark label equivalance relationship
-          if (match[i] != ref) {
-              Union(ref, match[i], labToNode);
-          }
+// Join the labels of the first row of strip s with those of the row above,
+// which is the last row of strip s-1. Several borders are merged at once.
+template<uint connectivity, typename T> class MergeBorderBody : public ParallelLoopBody
+{
+public:
+  MergeBorderBody(LabelStrips& strips) : strips(strips) {}
+  void operator()(const Range& range) const
+  {
+    const int width = strips.img.cols;
+    LabelSets& sets = strips.buf.sets;
+    for (int s = range.start; s < range.end; s++) {
+      int y = strips.StripBegin(s);
+      const uchar* img_up = strips.img.ptr<uchar>(y-1);
+      const uchar* img_row = strips.img.ptr<uchar>(y);
+      const T* lab_up = strips.labels.ptr<T>(y-1);
+      const T* lab_row = strips.labels.ptr<T>(y);
+      const uint base_up = strips.buf.base[s-1], base_row = strips.buf.base[s];
+      for (int x = 0; x < width; x++) {
+        const uchar v = img_row[x];
+        const uint label = base_row + (uint)lab_row[x];
+        if (img_up[x] == v)
+          sets.UnionShared(label, base_up + (uint)lab_up[x]);
+        if (connectivity == 8) {
+          if (x > 0 && img_up[x-1] == v)
+            sets.UnionShared(label, base_up + (uint)lab_up[x-1]);
+          if (x < width-1 && img_up[x+1] == v)
+            sets.UnionShared(label, base_up + (uint)lab_up[x+1]);
         }
       }
-    } // for x
-  } // for y
+    }
+  }
+private:
+  LabelStrips& strips;
+};
+
+template<typename T> class SecondPassBody : public ParallelLoopBody
+{
+public:
+  SecondPassBody(LabelStrips& strips) : strips(strips) {}
+  void operator()(const Range& range) const
+  {
+    LabelBuf& buf = strips.buf;
+    for (int s = range.start; s < range.end; s++) {
+      if (strips.with_stats)
+        SecondPass<T>(buf.sets, strips.img, strips.labels, strips.StripBegin(s), strips.StripEnd(s), buf.base[s],
+                      buf.strip_stats[s]);
+      else
+        SecondPass<T>(buf.sets, strips.labels, strips.StripBegin(s), strips.StripEnd(s), buf.base[s]);
+    }
+  }
+private:
+  LabelStrips& strips;
+};
+
+// Clear the statistics of num_objects objects
+static void ResetStats(LabelBuf& buf, vector<ComponentStats>& stats, uint num_objects)
+{
+  buf.Resize(stats, num_objects);
+  fill(stats.begin(), stats.end(), ComponentStats());
 }
 
+// with_stats: fill buf.stats with the objects' statistics
+template<uint connectivity, typename T>
+static int LabelStripsParallel(const Mat& img, Mat& labels, int num_strips, LabelBuf& buf, bool with_stats)
+{
+  int strip_height = (img.rows + num_strips - 1) / num_strips;
+  num_strips = (img.rows + strip_height - 1) / strip_height;
+  LabelStrips strips(img, labels, strip_height, buf, with_stats);
+  buf.Resize(buf.strip_sets, num_strips);
+  buf.Resize(buf.base, num_strips);
 
-// Second pass of the Union-Find labeling algorithm. Resolves 
-// the equivalences of labels. 
-// Modifies label by reference to avoid allocating extra memory. 
-void SecondPass(map<uint, node *>& labToNode, Mat& labels, uint maxLabel) { 
-  // decide on the final labels
-  map<uint, uint> equivClass;
-  for (int i = 0; i < (int)maxLabel; ++i) {
-    equivClass[i] = FindRoot(labToNode[i])->label;
-  }
-
-  // second pass
-  for (uint i = 0; i < labels.rows; i++) {
-    for (uint j = 0; j < labels.cols; j++) {
-//       labels.at<ushort>(i,j) = FindRoot(labToNode[labels.at<ushort>(i,j)])->label;
-      labels.at<ushort>(i,j) = equivClass[labels.at<ushort>(i,j)];
-    }
+  // first pass: every strip on its own
+  parallel_for_(Range(0, num_strips), FirstPassBody<connectivity, T>(strips), num_strips);
+
+  // all provisional labels in one set, strip s from base[s]
+  uint total = 0;
+  for (int s = 0; s < num_strips; s++) {
+    buf.base[s] = total;
+    total += buf.strip_sets[s].count;
+    MYCV_TRACE_COUNT("unions", buf.strip_sets[s].unions);
+  }
+  MYCV_TRACE_COUNT("provisional labels", total);
+  buf.Resize(buf.sets.parent, total);
+  buf.sets.count = total;
+  for (int s = 0; s < num_strips; s++) {
+    const LabelSets& local = buf.strip_sets[s];
+    for (uint i = 0; i < local.count; i++)
+      buf.sets.parent[buf.base[s] + i] = buf.base[s] + local.parent[i];
+  }
+
+  // merge along the strip borders
+  parallel_for_(Range(1, num_strips), MergeBorderBody<connectivity, T>(strips), num_strips-1);
+
+  uint num_objects = buf.sets.Flatten();
+  if (sizeof(T) == sizeof(ushort))
+    CV_Assert(num_objects <= USHRT_MAX+1); // more objects than CV_16U can hold
+
+  // second pass: every strip on its own again
+  if (with_stats) {
+    buf.Resize(buf.strip_stats, num_strips);
+    for (int s = 0; s < num_strips; s++)
+      ResetStats(buf, buf.strip_stats[s], num_objects);
   }
+  parallel_for_(Range(0, num_strips), SecondPassBody<T>(strips), num_strips);
+  if (with_stats) {
+    ResetStats(buf, buf.stats, num_objects);
+    for (int s = 0; s < num_strips; s++)
+      for (uint i = 0; i < num_objects; i++)
+        buf.stats[i].Merge(buf.strip_stats[s][i]);
+  }
+  return (int)num_objects;
 }
 
 
 // Relabels res using a predefinite order (the one then used 
 // for comparison). Will modify dst by reference to avoid allowing 
 // too much memory. 
-int RelabelImg(Mat& res, Mat& dst) {
+template<typename T> static int RelabelImg(Mat& res, Mat& dst, uint max_label) {
   uint num_objects = 0;
-  std::map<uint, uint> corresp;
-  uint elem, newColor;
+  vector<uint> corresp((size_t)max_label+1, UINT_MAX); // UINT_MAX: not found yet
   for (int i = 0; i < res.rows; ++i) {
+    const T* r = res.ptr<T>(i);
+    T* d = dst.ptr<T>(i);
     for (int j = 0; j < res.cols; ++j) {
-      elem = res.at<ushort>(i, j);
-      if (corresp.find(elem) == corresp.end()) { // not found, new element
-        corresp[elem] = num_objects;
-        newColor = num_objects;
-        num_objects++;
-      } else {
-        newColor = corresp[elem];
-      }
-      dst.at<ushort>(i, j) = newColor;
+      uint elem = (uint)r[j];
+      if (corresp[elem] == UINT_MAX) // new element
+        corresp[elem] = num_objects++;
+      d[j] = (T)corresp[elem];
     }
   }
-if (0) {
-  map<uint, uint>::iterator it;
-  for(it = corresp.begin() ; it != corresp.end() ; it++) {
-    cout<<"corresp["<<it->first<<"]= "<< it->second <<": "<<endl;
-  }
-}
   return num_objects;
 }
 
+int RelabelImg(Mat& res, Mat& dst) {
+  CV_Assert(res.type() == CV_16UC1 || res.type() == CV_32SC1);
+  CV_Assert(dst.size() == res.size() && dst.type() == res.type());
+  if (res.type() == CV_16UC1)
+    return RelabelImg<ushort>(res, dst, USHRT_MAX);
+  double max_label = 0;
+  if (!res.empty())
+    minMaxLoc(res, 0, &max_label);
+  return RelabelImg<int>(res, dst, (uint)max_label);
+}
+
 
 // The Union-Find labeling algoritm. Works in two passes and uses a Union-Find
 // data strucure to resolve the equivalences between labels. 
-int LabelConnected(const Mat& img, Mat& labels, uint connectivity=8)
+// with_stats: fill buf.stats with the objects' statistics
+template<uint connectivity, typename T>
+static int LabelImage(const Mat& img, Mat& labels, int num_threads, LabelBuf& buf, bool with_stats)
 {
-  uint currLabel = 0;
-  map<uint, node *> labToNode;
-  int num_objects=0;
+  MYCV_TRACE_SCOPE(with_stats ? "label with stats" : "label", (int64)img.total());
+  if (num_threads != 1) {
+    // one strip per thread, at least MinStripRows rows each. The strips
+    // bound parallel_for_'s concurrency: cv::setNumThreads is left alone,
+    // so concurrent calls do not race on it.
+    const int MinStripRows = 16;
+    int num_strips = min(num_threads > 0 ? num_threads : getNumThreads(), img.rows / MinStripRows);
+    if (num_strips > 1 && img.cols > 0)
+      return LabelStripsParallel<connectivity, T>(img, labels, num_strips, buf, with_stats);
+  }
+
+  LabelSets& sets = buf.sets;
+  buf.Resize(sets.parent, LabelCapacity<T>(img, 0, img.rows));
+  sets.count = 0;
+  MYCV_TRACE_ONLY(sets.unions = 0);
 
   // first pass: assign labels to different zones
-  if (connectivity == 4) {
-    FirstPass<4>(img, labels, labToNode, currLabel);
-  }
-  else if (connectivity == 8) {
-    FirstPass<8>(img, labels, labToNode, currLabel);
-  }
-  else {
-    cout << "This is not a valid connectivity! Exiting ..." << endl;
-    exit(1);
-  }
-
-  // second pass: merge classes if necessary
-  SecondPass(labToNode, labels, currLabel);
-
-  // relabel image and compact labels
-  num_objects = RelabelImg(labels, labels);
-
-// ----------------------
-// just for debug message
-if (0) {
-  map<uint, node*>::iterator it;
-  // Dump labToNode array
-  for(it = labToNode.begin() ; it != labToNode.end() ; it++) {
-    cout<<"labToNode["<<it->first<<"]= "<< labToNode[it->first] <<": ";
-    cout << "Label " << labToNode[it->first]->label;
-    node *n;
-    n = labToNode[it->first];
-    while (n->parent != n) {
-      cout << "->"<<n->parent->label;
-      n = n->parent;
-    }
-    cout << endl;
+  FirstPass<connectivity, T>(img, labels, sets, 0, img.rows);
+  MYCV_TRACE_COUNT("provisional labels", sets.count);
+  MYCV_TRACE_COUNT("unions", sets.unions);
+
+  // merge classes and compact labels in order of first appearance
+  int num_objects = (int)sets.Flatten();
+
+  // second pass: resolve every pixel's label
+  if (with_stats) {
+    ResetStats(buf, buf.stats, num_objects);
+    SecondPass<T>(sets, img, labels, 0, labels.rows, 0, buf.stats);
+  }
+  else
+    SecondPass<T>(sets, labels, 0, labels.rows);
+
+  return num_objects;
+}
+
+// with_stats: fill buf.stats with the objects' statistics
+static int LabelConnected(const Mat& img, Mat& labels, uint connectivity, int num_threads, int ltype,
+                          LabelBuf& buf, bool with_stats)
+{
+  CV_Assert(connectivity == 4 || connectivity == 8);
+  CV_Assert(img.type() == CV_8UC1);
+  CV_Assert(ltype == -1 || ltype == CV_16U || ltype == CV_32S);
+  if (ltype == -1) {
+    // 16 bits as long as the provisional labels fit, they are half the
+    // memory traffic; counting them is only needed on large frames
+    ltype = CV_16U;
+    if (img.total() > USHRT_MAX+1 && CountRunStarts(img, 0, img.rows) > USHRT_MAX+1)
+      ltype = CV_32S;
   }
+  buf.Create(labels, img.rows, img.cols, CV_MAKETYPE(ltype, 1));
+
+  if (ltype == CV_16U)
+    return (connectivity == 4) ? LabelImage<4, ushort>(img, labels, num_threads, buf, with_stats)
+                               : LabelImage<8, ushort>(img, labels, num_threads, buf, with_stats);
+  return (connectivity == 4) ? LabelImage<4, int>(img, labels, num_threads, buf, with_stats)
+                             : LabelImage<8, int>(img, labels, num_threads, buf, with_stats);
+}
+
+int LabelConnected(const Mat& img, Mat& labels, LabelBuf& buf, uint connectivity, int num_threads, int ltype)
+{
+  return LabelConnected(img, labels, connectivity, num_threads, ltype, buf, false);
+}
+
+int LabelConnected(const Mat& img, Mat& labels, uint connectivity, int num_threads, int ltype)
+{
+  LabelBuf buf;
+  return LabelConnected(img, labels, connectivity, num_threads, ltype, buf, false);
+}
 
-  for(it = labToNode.begin() ; it != labToNode.end() ; it++) {
-    if (labToNode[it->first] == labToNode[it->first]->parent) {
-      cout << "Root label: " << labToNode[it->first]->label << endl;
-      num_objects++;
+// The caller's table with rows rows. Like a std::vector it keeps its
+// memory while that has room: the rows are a view over the table's whole
+// allocation, grown or cut with adjustROI, and only a larger table is
+// allocated, twice as large.
+static void TableRows(Mat& table, int rows, int cols, int type, LabelBuf& buf)
+{
+  Size whole;
+  Point ofs;
+  if (!table.empty() && table.type() == type) {
+    table.locateROI(whole, ofs);
+    if (whole.width == cols && ofs.x == 0 && ofs.y == 0 && whole.height >= rows) {
+      table.adjustROI(0, rows - table.rows, 0, 0);
+      return;
     }
   }
-  cout << "currLabel: " << currLabel << endl;
-  cout << "num_objects: " << num_objects << endl;
+  int capacity = max(rows, 2*(table.type() == type && table.cols == cols ? whole.height : 0));
+  buf.CountAllocation();
+  table = Mat(max(capacity, 1), cols, type).rowRange(0, rows);
 }
-// ----------------------
+
+int LabelConnectedWithStats(const Mat& img, Mat& labels, Mat& stats, Mat& centroids, LabelBuf& buf,
+                            uint connectivity, int num_threads, int ltype)
+{
+  int num_objects = LabelConnected(img, labels, connectivity, num_threads, ltype, buf, true);
+
+  TableRows(stats, num_objects, LABEL_STAT_MAX, CV_32S, buf);
+  TableRows(centroids, num_objects, 2, CV_64F, buf);
+  for (int i = 0; i < num_objects; i++) {
+    const ComponentStats& st = buf.stats[i];
+    int* s = stats.ptr<int>(i);
+    s[CC_STAT_LEFT] = st.left;
+    s[CC_STAT_TOP] = st.top;
+    s[CC_STAT_WIDTH] = st.right - st.left + 1;
+    s[CC_STAT_HEIGHT] = st.bottom - st.top + 1;
+    s[CC_STAT_AREA] = st.area;
+    s[LABEL_STAT_PERIMETER] = st.perimeter;
+    double* c = centroids.ptr<double>(i);
+    c[0] = (double)st.sum_x / st.area;
+    c[1] = (double)st.sum_y / st.area;
+  }
   return num_objects;
 }
 
-
+int LabelConnectedWithStats(const Mat& img, Mat& labels, Mat& stats, Mat& centroids,
+                            uint connectivity, int num_threads, int ltype)
+{
+  LabelBuf buf;
+  return LabelConnectedWithStats(img, labels, stats, centroids, buf, connectivity, num_threads, ltype);
+}
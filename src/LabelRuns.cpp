@@ -0,0 +1,224 @@
+/*
+ * File: LabelRuns.cpp
+ * Purpose: Label Connected Components of sparse binary and edge images
+ *   - Only the nonzero pixels are objects, the zero background is not labeled.
+ *   - Every row is scanned for runs of nonzero pixels (16/32 bytes at a time
+ *     with SSE2/AVX2, so the empty parts of a row cost little), then the runs
+ *     of adjacent rows that touch are joined with the Union-Find sets of
+ *     LabelSets.hpp. The work follows the number of runs, not the image area.
+ */
+
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <climits>
+
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+
+// Append the runs of nonzero pixels of row y
+static void FindRowRuns_Scalar(const uchar* row, int x, int cols, int y, vector<LabelRun>& runs)
+{
+  while (x < cols) {
+    while (x < cols && row[x] == 0)
+      x++;
+    if (x == cols)
+      break;
+    int x0 = x;
+    while (x < cols && row[x] != 0)
+      x++;
+    LabelRun run = { y, x0, x, 0 };
+    runs.push_back(run);
+  }
+}
+
+#ifdef MYCV_X86
+// movemask of the zero bytes: the first set bit ends a run, the first
+// clear bit starts one
+static void FindRowRuns_SSE2(const uchar* row, int cols, int y, vector<LabelRun>& runs)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (;;) {
+    // skip the background
+    for (; x <= cols-16; x += 16) {
+      int nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row+x)), zero)) & 0xffff;
+      if (nonzero) {
+        x += __builtin_ctz(nonzero);
+        break;
+      }
+    }
+    if (x > cols-16)
+      break;
+    int x0 = x;
+    for (; x <= cols-16; x += 16) {
+      int zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row+x)), zero));
+      if (zeros) {
+        x += __builtin_ctz(zeros);
+        break;
+      }
+    }
+    if (x > cols-16) {
+      // the run goes on into the last bytes
+      while (x < cols && row[x] != 0)
+        x++;
+    }
+    LabelRun run = { y, x0, x, 0 };
+    runs.push_back(run);
+  }
+  FindRowRuns_Scalar(row, x, cols, y, runs);
+}
+
+MYCV_TARGET_AVX2
+static void FindRowRuns_AVX2(const uchar* row, int cols, int y, vector<LabelRun>& runs)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  int x = 0;
+  for (;;) {
+    for (; x <= cols-32; x += 32) {
+      uint nonzero = ~(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(row+x)), zero));
+      if (nonzero) {
+        x += __builtin_ctz(nonzero);
+        break;
+      }
+    }
+    if (x > cols-32)
+      break;
+    int x0 = x;
+    for (; x <= cols-32; x += 32) {
+      uint zeros = (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(row+x)), zero));
+      if (zeros) {
+        x += __builtin_ctz(zeros);
+        break;
+      }
+    }
+    if (x > cols-32) {
+      while (x < cols && row[x] != 0)
+        x++;
+    }
+    LabelRun run = { y, x0, x, 0 };
+    runs.push_back(run);
+  }
+  FindRowRuns_Scalar(row, x, cols, y, runs);
+}
+#endif
+
+static void FindRowRuns(const uchar* row, int cols, int y, vector<LabelRun>& runs, SimdPath simd)
+{
+  switch (simd) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: FindRowRuns_AVX2(row, cols, y, runs); break;
+    case SIMD_SSE2: FindRowRuns_SSE2(row, cols, y, runs); break;
+#endif
+    default:        FindRowRuns_Scalar(row, 0, cols, y, runs); break;
+  }
+}
+
+// Join the runs [up, up_end) of a row with the runs [cur, cur_end) of the
+// row below. Both lists are sorted by x, so one merge-like sweep finds all
+// pairs that touch: directly above for 4-connectivity, diagonally too for 8.
+static void UnionRows(const vector<LabelRun>& runs, int up, int up_end, int cur, int cur_end, uint connectivity,
+                      LabelSets& sets)
+{
+  const int reach = (connectivity == 8) ? 1 : 0; // how far a run touches past its ends
+  while (up < up_end && cur < cur_end) {
+    const LabelRun& a = runs[up];
+    const LabelRun& b = runs[cur];
+    if (a.x1 + reach <= b.x0)
+      up++;
+    else if (b.x1 + reach <= a.x0)
+      cur++;
+    else {
+      sets.Union(up, cur);
+      // the run ending first can not touch the next run of the other row
+      if (a.x1 < b.x1)
+        up++;
+      else
+        cur++;
+    }
+  }
+}
+
+// Label the runs, the sets and the growth of runs are counted in buf
+static int LabelRuns(const Mat& img, vector<LabelRun>& runs, uint connectivity, SimdPath simd, LabelBuf& buf)
+{
+  CV_Assert(connectivity == 4 || connectivity == 8);
+  CV_Assert(img.type() == CV_8UC1);
+  MYCV_TRACE_SCOPE("label runs", (int64)img.total());
+  simd = ResolveSimdPath(simd);
+
+  runs.clear();
+  int up = 0, cur = 0; // first run of the previous and of the current row
+  LabelSets& sets = buf.sets;
+  sets.count = 0;
+  MYCV_TRACE_ONLY(sets.unions = 0);
+  for (int y = 0; y < img.rows; y++) {
+    size_t capacity = runs.capacity();
+    FindRowRuns(img.ptr<uchar>(y), img.cols, y, runs, simd);
+    if (runs.capacity() != capacity)
+      buf.CountAllocation();
+    // every run is a provisional label, its index
+    buf.Resize(sets.parent, max(runs.size(), sets.parent.size()));
+    while (sets.count < runs.size())
+      sets.NewLabel();
+    if (y > 0)
+      UnionRows(runs, up, cur, cur, (int)runs.size(), connectivity, sets);
+    up = cur;
+    cur = (int)runs.size();
+  }
+
+  // runs are in raster order, the root run is the first of its object:
+  // objects are numbered 1, 2, ... in order of first appearance
+  MYCV_TRACE_COUNT("runs", (int64)runs.size());
+  MYCV_TRACE_COUNT("unions", sets.unions);
+  int num_objects = (int)sets.Flatten();
+  for (size_t i = 0; i < runs.size(); i++)
+    runs[i].label = (int)sets.parent[i] + 1;
+  return num_objects + 1;
+}
+
+int LabelRuns(const Mat& img, vector<LabelRun>& runs, uint connectivity, SimdPath simd)
+{
+  LabelBuf buf;
+  return LabelRuns(img, runs, connectivity, simd, buf);
+}
+
+template<typename T> static void PaintRuns(const vector<LabelRun>& runs, Mat& labels)
+{
+  for (size_t i = 0; i < runs.size(); i++) {
+    const LabelRun& run = runs[i];
+    T* lab = labels.ptr<T>(run.y);
+    for (int x = run.x0; x < run.x1; x++)
+      lab[x] = (T)run.label;
+  }
+}
+
+int LabelRuns(const Mat& img, Mat& labels, LabelBuf& buf, uint connectivity, int ltype, SimdPath simd)
+{
+  CV_Assert(ltype == -1 || ltype == CV_16U || ltype == CV_32S);
+  vector<LabelRun>& runs = buf.runs;
+  int num_labels = LabelRuns(img, runs, connectivity, simd, buf);
+  if (ltype == -1)
+    ltype = (num_labels <= USHRT_MAX+1) ? CV_16U : CV_32S;
+  if (ltype == CV_16U)
+    CV_Assert(num_labels <= USHRT_MAX+1); // more objects than CV_16U can hold
+
+  buf.Create(labels, img.rows, img.cols, CV_MAKETYPE(ltype, 1));
+  labels.setTo(Scalar::all(0));
+  if (ltype == CV_16U)
+    PaintRuns<ushort>(runs, labels);
+  else
+    PaintRuns<int>(runs, labels);
+  return num_labels;
+}
+
+int LabelRuns(const Mat& img, Mat& labels, uint connectivity, int ltype, SimdPath simd)
+{
+  LabelBuf buf;
+  return LabelRuns(img, labels, buf, connectivity, ltype, simd);
+}
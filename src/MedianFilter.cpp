@@ -1,84 +1,309 @@
 // By Steven Chen
 // MedianFilter: Remove extreme pixel value (noise) and replace it by medium value of neighbers.
+//   3x3 and 5x5: a min/max sorting network (Devillard's opt_med9 and
+//   opt_med25, 19 and 99 comparators) picks the median without branches,
+//   16 (SSE2) or 32 (AVX2) pixels at a time.
+//   Larger windows: sliding histograms in constant time per pixel
+//   (Perreault & Hebert). Every column keeps the histogram of its 2r+1
+//   window rows; the window histogram moves along a row by adding one
+//   column histogram and removing another. A 16-bin coarse histogram
+//   narrows the median search to 16 fine bins.
+//   The window rows are kept in a ring of rows padded with the border
+//   (FilterBorder), so dst may be src and the frame is never copied. The
+//   histograms cover the border columns too.
 
-#include <iostream>
+#include "MyFilter.hpp"
+
+#include <cstring>
+#include <vector>
 using namespace std;
 
 #include <opencv2/opencv.hpp>
 using namespace cv;
- 
-// Sort array from minimum to maximum
-void Sort9(unsigned char data[9])
+
+// Sorting networks, S(a, b) puts min(a, b) into a and max(a, b) into b
+#define MEDIAN9_NETWORK(S, p) \
+  S(p[1], p[2]);  S(p[4], p[5]);  S(p[7], p[8]);  S(p[0], p[1]);  S(p[3], p[4]);  \
+  S(p[6], p[7]);  S(p[1], p[2]);  S(p[4], p[5]);  S(p[7], p[8]);  S(p[0], p[3]);  \
+  S(p[5], p[8]);  S(p[4], p[7]);  S(p[3], p[6]);  S(p[1], p[4]);  S(p[2], p[5]);  \
+  S(p[4], p[7]);  S(p[4], p[2]);  S(p[6], p[4]);  S(p[4], p[2]);  /* median in p[4] */
+
+#define MEDIAN25_NETWORK(S, p) \
+  S(p[0], p[1]);   S(p[3], p[4]);   S(p[2], p[4]);   S(p[2], p[3]);   S(p[6], p[7]);   \
+  S(p[5], p[7]);   S(p[5], p[6]);   S(p[9], p[10]);  S(p[8], p[10]);  S(p[8], p[9]);   \
+  S(p[12], p[13]); S(p[11], p[13]); S(p[11], p[12]); S(p[15], p[16]); S(p[14], p[16]); \
+  S(p[14], p[15]); S(p[18], p[19]); S(p[17], p[19]); S(p[17], p[18]); S(p[21], p[22]); \
+  S(p[20], p[22]); S(p[20], p[21]); S(p[23], p[24]); S(p[2], p[5]);   S(p[3], p[6]);   \
+  S(p[0], p[6]);   S(p[0], p[3]);   S(p[4], p[7]);   S(p[1], p[7]);   S(p[1], p[4]);   \
+  S(p[11], p[14]); S(p[8], p[14]);  S(p[8], p[11]);  S(p[12], p[15]); S(p[9], p[15]);  \
+  S(p[9], p[12]);  S(p[13], p[16]); S(p[10], p[16]); S(p[10], p[13]); S(p[20], p[23]); \
+  S(p[17], p[23]); S(p[17], p[20]); S(p[21], p[24]); S(p[18], p[24]); S(p[18], p[21]); \
+  S(p[19], p[22]); S(p[8], p[17]);  S(p[9], p[18]);  S(p[0], p[18]);  S(p[0], p[9]);   \
+  S(p[10], p[19]); S(p[1], p[19]);  S(p[1], p[10]);  S(p[11], p[20]); S(p[2], p[20]);  \
+  S(p[2], p[11]);  S(p[12], p[21]); S(p[3], p[21]);  S(p[3], p[12]);  S(p[13], p[22]); \
+  S(p[4], p[22]);  S(p[4], p[13]);  S(p[14], p[23]); S(p[5], p[23]);  S(p[5], p[14]);  \
+  S(p[15], p[24]); S(p[6], p[24]);  S(p[6], p[15]);  S(p[7], p[16]);  S(p[7], p[19]);  \
+  S(p[13], p[21]); S(p[15], p[23]); S(p[7], p[13]);  S(p[7], p[15]);  S(p[1], p[9]);   \
+  S(p[3], p[11]);  S(p[5], p[17]);  S(p[11], p[17]); S(p[9], p[17]);  S(p[4], p[10]);  \
+  S(p[6], p[12]);  S(p[7], p[14]);  S(p[4], p[6]);   S(p[4], p[7]);   S(p[12], p[14]); \
+  S(p[10], p[14]); S(p[6], p[7]);   S(p[10], p[12]); S(p[6], p[10]);  S(p[6], p[17]);  \
+  S(p[12], p[17]); S(p[7], p[17]);  S(p[7], p[10]);  S(p[12], p[18]); S(p[7], p[12]);  \
+  S(p[10], p[18]); S(p[12], p[20]); S(p[10], p[20]); S(p[10], p[12]); /* median in p[12] */
+
+#define SORT_U8(a, b)   { uchar t_ = min(a, b); b = max(a, b); a = t_; }
+
+// rows: the 2r+1 window rows, padded by r replicated pixels on both sides
+static void MedianRow_Scalar(const uchar* const* rows, uchar* dst, int x, int cols, int radius)
 {
-  int i;
-  int j;
-  int min_val;
-  int index = 0;
-  for (i = 0; i < 9; i++) {
-    min_val = data[i];
-    index = i;
-    for (j = i+1; j < 9; j++) {       
-      if (min_val > data[j]) {       
-         min_val = data[j];
-         index = j;
-      }
+  const int win = 2*radius + 1;
+  uchar p[25];
+  for (; x<cols; x++) {
+    for (int k=0; k<win; k++)
+      for (int j=0; j<win; j++)
+        p[k*win+j] = rows[k][x+j];
+    if (radius == 1) {
+      MEDIAN9_NETWORK(SORT_U8, p);
+      dst[x] = p[4];
+    } else {
+      MEDIAN25_NETWORK(SORT_U8, p);
+      dst[x] = p[12];
     }
-    if (i != index) {
-      data[index] = data[i];
-      data[i] = min_val;
+  }
+}
+
+#ifdef MYCV_X86
+#define SORT_SSE2(a, b) { __m128i t_ = _mm_min_epu8(a, b); b = _mm_max_epu8(a, b); a = t_; }
+#define SORT_AVX2(a, b) { __m256i t_ = _mm256_min_epu8(a, b); b = _mm256_max_epu8(a, b); a = t_; }
+
+static void MedianRow_SSE2(const uchar* const* rows, uchar* dst, int cols, int radius)
+{
+  const int win = 2*radius + 1;
+  __m128i p[25];
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    for (int k=0; k<win; k++)
+      for (int j=0; j<win; j++)
+        p[k*win+j] = _mm_loadu_si128((const __m128i*)(rows[k]+x+j));
+    if (radius == 1) {
+      MEDIAN9_NETWORK(SORT_SSE2, p);
+      _mm_storeu_si128((__m128i*)(dst+x), p[4]);
+    } else {
+      MEDIAN25_NETWORK(SORT_SSE2, p);
+      _mm_storeu_si128((__m128i*)(dst+x), p[12]);
     }
   }
+  MedianRow_Scalar(rows, dst, x, cols, radius);
 }
 
-// MedianFilter: Remove extreme pixel value (noise) and replace it by medium value of neighbers.
-void MedianFilter(const Mat& src, Mat& dst)
+MYCV_TARGET_AVX2
+static void MedianRow_AVX2(const uchar* const* rows, uchar* dst, int cols, int radius)
+{
+  const int win = 2*radius + 1;
+  __m256i p[25];
+  int x = 0;
+  for (; x <= cols-32; x += 32) {
+    for (int k=0; k<win; k++)
+      for (int j=0; j<win; j++)
+        p[k*win+j] = _mm256_loadu_si256((const __m256i*)(rows[k]+x+j));
+    if (radius == 1) {
+      MEDIAN9_NETWORK(SORT_AVX2, p);
+      _mm256_storeu_si256((__m256i*)(dst+x), p[4]);
+    } else {
+      MEDIAN25_NETWORK(SORT_AVX2, p);
+      _mm256_storeu_si256((__m256i*)(dst+x), p[12]);
+    }
+  }
+  MedianRow_Scalar(rows, dst, x, cols, radius);
+}
+#endif
+
+static void MedianRow(const uchar* const* rows, uchar* dst, int cols, int radius, SimdPath simd)
+{
+  switch (simd) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: MedianRow_AVX2(rows, dst, cols, radius); break;
+    case SIMD_SSE2: MedianRow_SSE2(rows, dst, cols, radius); break;
+#endif
+    default:        MedianRow_Scalar(rows, dst, 0, cols, radius); break;
+  }
+}
+
+// Histograms of 256 fine and 16 coarse bins, counts up to 255*255
+static const int HIST_FINE = 256;
+static const int HIST_COARSE = 16;
+
+// hist[i] += add[i] - sub[i], n is a multiple of 16
+static void HistUpdate_Scalar(ushort* hist, const ushort* add, const ushort* sub, int n)
+{
+  for (int i=0; i<n; i++)
+    hist[i] = (ushort)(hist[i] + add[i] - sub[i]);
+}
+
+#ifdef MYCV_X86
+static void HistUpdate_SSE2(ushort* hist, const ushort* add, const ushort* sub, int n)
+{
+  for (int i=0; i<n; i += 8) {
+    __m128i h = _mm_loadu_si128((const __m128i*)(hist+i));
+    h = _mm_add_epi16(h, _mm_loadu_si128((const __m128i*)(add+i)));
+    h = _mm_sub_epi16(h, _mm_loadu_si128((const __m128i*)(sub+i)));
+    _mm_storeu_si128((__m128i*)(hist+i), h);
+  }
+}
+
+MYCV_TARGET_AVX2
+static void HistUpdate_AVX2(ushort* hist, const ushort* add, const ushort* sub, int n)
+{
+  for (int i=0; i<n; i += 16) {
+    __m256i h = _mm256_loadu_si256((const __m256i*)(hist+i));
+    h = _mm256_add_epi16(h, _mm256_loadu_si256((const __m256i*)(add+i)));
+    h = _mm256_sub_epi16(h, _mm256_loadu_si256((const __m256i*)(sub+i)));
+    _mm256_storeu_si256((__m256i*)(hist+i), h);
+  }
+}
+#endif
+
+static void HistUpdate(ushort* hist, const ushort* add, const ushort* sub, int n, SimdPath simd)
+{
+  switch (simd) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: HistUpdate_AVX2(hist, add, sub, n); break;
+    case SIMD_SSE2: HistUpdate_SSE2(hist, add, sub, n); break;
+#endif
+    default:        HistUpdate_Scalar(hist, add, sub, n); break;
+  }
+}
+
+// Column histograms of the current window rows, in FilterBuf
+struct MedianColumnHist {
+  ushort* fine;   // cols x 256
+  ushort* coarse; // cols x 16
+  MedianColumnHist(FilterBuf& buf, int cols)
+  {
+    buf.Resize(buf.hist_fine, max(cols*HIST_FINE, 1));
+    buf.Resize(buf.hist_coarse, max(cols*HIST_COARSE, 1));
+    fine = &buf.hist_fine[0];
+    coarse = &buf.hist_coarse[0];
+    memset(fine, 0, cols*HIST_FINE*sizeof(ushort));
+    memset(coarse, 0, cols*HIST_COARSE*sizeof(ushort));
+  }
+  void Add(int x, int v, int n) {
+    fine[x*HIST_FINE + v] += n;
+    coarse[x*HIST_COARSE + (v>>4)] += n;
+  }
+};
+
+// col_hist covers the cols+2*radius columns of the padded rows
+static void HistMedianRow(const MedianColumnHist& col_hist, uchar* dst, int cols, int radius, SimdPath simd)
 {
-  Mat raster = Mat::zeros(src.rows+2, src.cols+2, src.type()); 
-  // Copy & Duplicate boundary for image
-  for (int y=0; y<raster.rows; y++) {
-    for (int x=0; x<raster.cols; x++) {
-      if (y==0)
-        if (x==0)
-          raster.at<uchar>(y, x) = src.at<uchar>(y, x);
-        else if (x==raster.cols-1)
-          raster.at<uchar>(y, x) = src.at<uchar>(y, x-2);
-        else
-          raster.at<uchar>(y, x) = src.at<uchar>(y, x-1);
-      else if (y==raster.rows-1) 
-        if (x==0)
-          raster.at<uchar>(y, x) = src.at<uchar>(y-2, x);
-        else if (x==raster.cols-1)
-          raster.at<uchar>(y, x) = src.at<uchar>(y-2, x-2);
-        else
-          raster.at<uchar>(y, x) = src.at<uchar>(y-2, x-1);
-      else
-        if (x==0)
-          raster.at<uchar>(y, x) = src.at<uchar>(y-1, x);
-        else if (x==raster.cols-1)
-          raster.at<uchar>(y, x) = src.at<uchar>(y-1, x-2);
-        else
-          raster.at<uchar>(y, x) = src.at<uchar>(y-1, x-1);
+  const int half = (2*radius+1)*(2*radius+1) / 2;
+  ushort fine[HIST_FINE], coarse[HIST_COARSE];
+  memset(fine, 0, sizeof(fine));
+  memset(coarse, 0, sizeof(coarse));
+  const ushort* col_fine = col_hist.fine;
+  const ushort* col_coarse = col_hist.coarse;
+  for (int c=0; c<=2*radius; c++) {
+    for (int i=0; i<HIST_FINE; i++)
+      fine[i] += col_fine[c*HIST_FINE + i];
+    for (int i=0; i<HIST_COARSE; i++)
+      coarse[i] += col_coarse[c*HIST_COARSE + i];
+  }
+
+  for (int x=0; x<cols; x++) {
+    // median: the first value whose cumulative count exceeds half the window
+    int sum = 0, c = 0;
+    while (sum + coarse[c] <= half)
+      sum += coarse[c++];
+    int v = c*HIST_COARSE;
+    while (sum + fine[v] <= half)
+      sum += fine[v++];
+    dst[x] = (uchar)v;
+
+    // slide: column x+r+1 enters, column x-r leaves (padded x+2r+1 and x)
+    int c_in = x+2*radius+1, c_out = x;
+    if (x+1 < cols) {
+      HistUpdate(fine, col_fine + c_in*HIST_FINE, col_fine + c_out*HIST_FINE, HIST_FINE, simd);
+      HistUpdate(coarse, col_coarse + c_in*HIST_COARSE, col_coarse + c_out*HIST_COARSE, HIST_COARSE, simd);
     }
   }
+}
+
+// MedianFilter over a (2*radius+1)^2 window, radius <= 127
+void MedianFilter(const Mat& src, Mat& dst, int radius, FilterBuf& buf, SimdPath simd, const FilterBorder& border)
+{
+  CV_Assert(src.type() == CV_8UC1);
+  CV_Assert(radius >= 0 && radius <= 127); // window counts fit in 16 bits
+  MYCV_TRACE_SCOPE("median", (int64)src.total());
+  dst.create(src.size(), CV_8UC1);
+  const int rows = src.rows, cols = src.cols;
+  if (rows == 0 || cols == 0)
+    return;
+  if (radius == 0) {
+    src.copyTo(dst);
+    return;
+  }
+  const int win = 2*radius + 1;
+  const bool use_hist = radius > 2;
+  simd = ResolveSimdPath(simd);
 
-  int width = raster.cols;
-  int height = raster.rows;
-  int d;
-  unsigned char data[9];
-
-  // Execute medium filtering
-  for (int y = 1; y < height - 1; y++) {
-     for (int x = 1; x < width - 1; x++) {
-        d = 0;
-        for (int m = -1; m <= 1; m++) {
-           for (int n = -1; n <= 1; n++) {
-              data[d] = raster.at<uchar>(y+m, x+n);
-              d++;
-           }
-         }
-         Sort9(data);
-         dst.at<uchar>(y-1, x-1) = data[4];
-      }
-   }
+  // window rows, row k (may be outside the image) lives in slot (k+radius)%win
+  const int padded = cols + 2*radius;
+  Mat& ring = buf.median_ring;
+  buf.Create(ring, win, padded, CV_8UC1);
+  const uchar* constant_row = 0;
+  if (border.type == BORDER_CONSTANT) {
+    buf.Resize(buf.border_row, cols);
+    memset(&buf.border_row[0], border.value, cols);
+    constant_row = &buf.border_row[0];
+  }
+  for (int k=-radius; k<=radius; k++)
+    border.PadRow(border.Row(src, k, constant_row), ring.ptr<uchar>((k+radius) % win), cols, radius);
+
+  MedianColumnHist col_hist(buf, use_hist ? padded : 0);
+  if (use_hist) {
+    for (int k=0; k<win; k++) {
+      const uchar* r = ring.ptr<uchar>(k);
+      for (int x=0; x<padded; x++)
+        col_hist.Add(x, r[x], 1);
+    }
+  }
+
+  buf.Resize(buf.win_rows, win);
+  vector<const uchar*>& win_rows = buf.win_rows;
+  for (int y=0; y<rows; y++) {
+    if (use_hist) {
+      HistMedianRow(col_hist, dst.ptr<uchar>(y), cols, radius, simd);
+    } else {
+      for (int k=0; k<win; k++)
+        win_rows[k] = ring.ptr<uchar>((y+k) % win);
+      MedianRow(&win_rows[0], dst.ptr<uchar>(y), cols, radius, simd);
+    }
+
+    if (y+1 < rows) {
+      // row y-radius leaves the window, row y+radius+1 (not yet overwritten) enters;
+      // below the image it maps to a row of the window, taken from the ring
+      // as src may be dst
+      uchar* slot = ring.ptr<uchar>(y % win);
+      int k = y+radius+1, i = border.Index(k, rows);
+      const uchar* next = i < 0 ? constant_row : k < rows ? src.ptr<uchar>(k) : ring.ptr<uchar>((i+radius) % win) + radius;
+      if (use_hist)
+        for (int x=0; x<padded; x++)
+          col_hist.Add(x, slot[x], -1);
+      border.PadRow(next, slot, cols, radius);
+      if (use_hist)
+        for (int x=0; x<padded; x++)
+          col_hist.Add(x, slot[x], 1);
+    }
+  }
+}
+
+void MedianFilter(const Mat& src, Mat& dst, int radius, SimdPath simd, const FilterBorder& border)
+{
+  FilterBuf buf;
+  MedianFilter(src, dst, radius, buf, simd, border);
 }
 
+// MedianFilter: 3x3
+void MedianFilter(const Mat& src, Mat& dst)
+{
+  MedianFilter(src, dst, 1);
+}
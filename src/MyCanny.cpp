@@ -7,13 +7,31 @@
  * 2. Non-Maximum Suppression
  * 3. hystersis threshold
 
+ * The magnitude (GradMagnitude.cpp) is CV_8U saturated at 255, or CV_16U
+ * so that high-contrast edges keep their real value.
+ * NMS (NonMaxSuppress.cpp) interpolates the neighbours along the gradient,
+ * or quantizes the direction into 4 bins (faster, vectorized).
+ * Every stage is a row kernel. The serial mode runs the stages over the
+ * whole frame; the tiled mode runs all stages per horizontal band on
+ * cv::parallel_for_. A band recomputes a 2-row halo of gradients and a
+ * 1-row halo of NMS, so its rows come out identical to the serial ones.
+ * The fused mode streams a frame or band through 3-row rings of gradient,
+ * magnitude and NMS, so scratch memory is O(width) instead of O(width*height).
+ *
+ * Hysteresis either checks the 8 direct neighbours once (single pass), or
+ * tracks edges: weak pixels connected to a strong one through any chain
+ * of weak pixels are promoted, using a preallocated stack. The tiled mode
+ * tracks inside every band first, then continues from the band borders.
+
   Date: 107/10/15
   Author: Steven Chen
 */
 
 #include "define.hpp"
+#include "MyCanny.hpp"
 
 #include <iostream>
+#include <vector>
 using namespace std;
 
 #include <opencv2/opencv.hpp>
@@ -21,156 +39,443 @@ using namespace cv;
  
 // int otsu_threshold (const Mat& src, Mat& dst, int typ=0);
 
-void MySobel (const Mat& src, Mat& grad_x, Mat& grad_y)
-{
-  // Horizontal filter
-  const Mat gx = (Mat_<int>(3, 3) << -1, 0, 1, -2, 0, 2, -1, 0, 1);
-  // Vertical filter
-  const Mat gy = (Mat_<int>(3, 3) << -1, -2, -1, 0, 0, 0, 1, 2, 1);
-
-  // Duplicate boundary for image
-  //// Mat raster;
-  //// raster = Mat::zeros(src.rows+2, src.cols+2, src.type()); 
-  //// src.copyTo(raster(Rect(1, 1, src.cols, src.rows)));
-  //// raster.row(1).copyTo(raster.row(0));
-  //// raster.col(1).copyTo(raster.col(0));
-  //// raster.col(raster.cols-2).copyTo(raster.col(raster.cols-1));
-  //// raster.row(raster.rows-2).copyTo(raster.row(raster.rows-1));
-  // Learn to use another OCV function to duplicate boundary for image
-  int border = 1;
-  Mat raster(src.rows+border*2, src.cols+border*2, src.depth());
-  copyMakeBorder(src, raster, border, border, border, border, BORDER_REPLICATE);
-
-  // Calculate Gx/Gy gradient
-  for (int y=1; y<raster.rows-1; y++) {
-    for (int x=1; x<raster.cols-1; x++) {
-      for (int m=-1; m<=1; m++) {
-        for (int n=-1; n<=1; n++) {
-          grad_x.at<short>(y-1, x-1) += raster.at<uchar>(y+m, x+n) * gx.at<int>(1+m, 1+n);
-          grad_y.at<short>(y-1, x-1) += raster.at<uchar>(y+m, x+n) * gy.at<int>(1+m, 1+n);
-        } // n
-      } // m
-    } // x
-  } // y
+// Hysteresis threshold of row y, n0/n1/n2: NMS of rows y-1, y, y+1
+template<typename MagT> static void HysteresisRow(const MagT* n0, const MagT* n1, const MagT* n2,
+                          uchar* detected_edges, int cols, int lo_threshold, int hi_threshold)
+{
+  detected_edges[0] = detected_edges[cols-1] = 0;
+  for (int x=1; x<cols-1; x++) {
+    if (n1[x] == 0) // suppressed, whatever the thresholds
+      detected_edges[x] = 0;
+    else if (n1[x] >= hi_threshold)
+      detected_edges[x] = 255;
+    else if (n1[x] < lo_threshold)
+      detected_edges[x] = 0;
+    else
+      if (n0[x-1] >= hi_threshold || n0[x] >= hi_threshold || n0[x+1] >= hi_threshold ||
+          n1[x-1] >= hi_threshold ||                          n1[x+1] >= hi_threshold ||
+          n2[x-1] >= hi_threshold || n2[x] >= hi_threshold || n2[x+1] >= hi_threshold)
+        detected_edges[x] = 255;
+      else
+        detected_edges[x] = 0;
+  }
 }
 
+// Weak/strong class of row y for edge tracking: 255 strong, 1 weak, 0 not edge.
+// Returns the number of weak+strong pixels, which bounds the tracking stack.
+template<typename MagT> static int ClassifyRow(const MagT* nmax_suppress, uchar* detected_edges, int cols, int lo_threshold, int hi_threshold)
+{
+  int candidates = 0;
+  detected_edges[0] = detected_edges[cols-1] = 0;
+  for (int x=1; x<cols-1; x++) {
+    int v = nmax_suppress[x];
+    uchar c = (v == 0) ? 0 : (v >= hi_threshold) ? 255 : (v >= lo_threshold) ? 1 : 0;
+    detected_edges[x] = c;
+    candidates += (c != 0);
+  }
+  return candidates;
+}
 
+// Last per-row stage: final edges (single pass) or the class map (tracking)
+template<typename MagT> static int EdgeRow(const MagT* n0, const MagT* n1, const MagT* n2, uchar* detected_edges, int cols,
+                                           int lo_threshold, int hi_threshold, CannyHysteresis hysteresis)
+{
+  if (hysteresis == CANNY_HYST_SINGLE_PASS) {
+    HysteresisRow(n0, n1, n2, detected_edges, cols, lo_threshold, hi_threshold);
+    return 0;
+  }
+  return ClassifyRow(n1, detected_edges, cols, lo_threshold, hi_threshold);
+}
 
-/*
- * @function MyCanny
- * 1. Get Gradient's magnitude
- * 2. Non-Maximum Suppression
- * 3. hystersis threshold
- */
-void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_threshold, bool L2gradient=true, bool debug=false)
-{
-  Mat grad_x, grad_y; // CV_16S
-  grad_x = Mat::zeros(src.rows, src.cols, CV_16S);
-  grad_y = Mat::zeros(src.rows, src.cols, CV_16S);
-
-  #ifdef OCV_SOBEL
-    Sobel(src, grad_x, CV_16S, 1, 0, 3, 1, 0, BORDER_DEFAULT);
-    Sobel(src, grad_y, CV_16S, 0, 1, 3, 1, 0, BORDER_DEFAULT);
-  #else
-    MySobel(src, grad_x, grad_y);
-  #endif
-
-  // Gradient's magnitude
-  Mat grad_mag; // CV_8U
-  Mat abs_grad_x, abs_grad_y;
-  if (L2gradient == false) {
-    convertScaleAbs(grad_x, abs_grad_x); // convert to CV_8U
-    convertScaleAbs(grad_y, abs_grad_y); // convert to CV_8U
-    addWeighted(abs_grad_x, 0.5, abs_grad_y, 0.5, 0, grad_mag);
+static int EdgeRow(const uchar* n0, const uchar* n1, const uchar* n2, uchar* detected_edges, int cols,
+                   int lo_threshold, int hi_threshold, const CannyOptions& opts)
+{
+  if (opts.mag_depth == CV_16U)
+    return EdgeRow((const ushort*)n0, (const ushort*)n1, (const ushort*)n2, detected_edges, cols, lo_threshold, hi_threshold, opts.hysteresis);
+  return EdgeRow(n0, n1, n2, detected_edges, cols, lo_threshold, hi_threshold, opts.hysteresis);
+}
+
+// Push the strong pixels of rows [y0, y1), returns the new stack size
+static int PushStrong(Mat& detected_edges, int y0, int y1, uchar** stack, int sp)
+{
+  for (int y=y0; y<y1; y++) {
+    uchar* edges = detected_edges.ptr<uchar>(y);
+    for (int x=0; x<detected_edges.cols; x++)
+      if (edges[x] == 255)
+        stack[sp++] = edges + x;
+  }
+  return sp;
+}
+
+// Promote weak pixels 8-connected to the pixels on the stack. Only rows
+// [y0, y1) are visited; the boundary is never weak, so x never wraps.
+static void TraceEdges(Mat& detected_edges, int y0, int y1, uchar** stack, int sp)
+{
+  const uchar* lo_ptr = detected_edges.ptr<uchar>(y0);
+  const uchar* hi_ptr = detected_edges.ptr<uchar>(0) + y1*detected_edges.step;
+  const ptrdiff_t step = detected_edges.step;
+  const ptrdiff_t offset[8] = { -step-1, -step, -step+1, -1, 1, step-1, step, step+1 };
+  while (sp > 0) {
+    uchar* p = stack[--sp];
+    for (int i=0; i<8; i++) {
+      uchar* n = p + offset[i];
+      if (n >= lo_ptr && n < hi_ptr && *n == 1) {
+        *n = 255;
+        stack[sp++] = n;
+      }
+    }
+  }
+}
+
+// Weak pixels that were not reached are not edges
+static void DropWeak(Mat& detected_edges, int y0, int y1)
+{
+  for (int y=y0; y<y1; y++) {
+    uchar* edges = detected_edges.ptr<uchar>(y);
+    for (int x=0; x<detected_edges.cols; x++)
+      edges[x] = (edges[x] == 255) ? 255 : 0;
+  }
+}
+
+class DropWeakBody : public ParallelLoopBody
+{
+public:
+  DropWeakBody(Mat& detected_edges, int band_height) : detected_edges(detected_edges), band_height(band_height) {}
+  void operator()(const Range& range) const
+  {
+    DropWeak(detected_edges, range.start*band_height, min(range.end*band_height, detected_edges.rows));
+  }
+private:
+  Mat& detected_edges;
+  int band_height;
+};
+
+// Gradients and NMS of the image rows [n0, n1) into nmax_suppress, whose
+// row 0 is image row n0. buf's gradients and magnitude receive the rows
+// [n0-1, n1+1) clipped to the frame; returns the first of them.
+static int NmsRows(const Mat& src, int n0, int n1, const CannyOptions& opts, CannyBandBuf& buf, ScratchBuf& scratch,
+                   Mat& nmax_suppress)
+{
+  int rows = src.rows, cols = src.cols;
+  int g0 = max(n0-1, 0), g1 = min(n1+1, rows);
+
+  scratch.Create(buf.grad_x, g1-g0, cols, CV_16S);
+  scratch.Create(buf.grad_y, g1-g0, cols, CV_16S);
+  if (opts.sobel == CANNY_SOBEL_OPENCV) {
+    // a ROI keeps its real neighbours, so the band border is not a frame border
+    MYCV_TRACE_SCOPE("sobel opencv", (int64)(g1-g0)*cols);
+    Sobel(src.rowRange(g0, g1), buf.grad_x, CV_16S, 1, 0, 3, 1, 0, BORDER_DEFAULT);
+    Sobel(src.rowRange(g0, g1), buf.grad_y, CV_16S, 0, 1, 3, 1, 0, BORDER_DEFAULT);
   } else {
-    pow(grad_x, 2, abs_grad_x);
-    pow(grad_y, 2, abs_grad_y);
-    Mat sum = abs_grad_x + abs_grad_y;
-    sum.convertTo(grad_mag, CV_32F); // convert to CV_32F
-    sqrt(grad_mag, grad_mag);
-    convertScaleAbs(grad_mag, grad_mag); // convert CV_32F to CV_8U
-  }
-
-  // Non-Maximum Suppression
-  short gx, gy;
-  int g1, g2, g3, g4;
-  double dTemp, dTemp1, dTemp2;
-  double weight;
-  Mat nmax_suppress = Mat::zeros(src.rows, src.cols, src.type()); // all 0s for set all boundary are not edge
-  for (int y=1; y<grad_mag.rows-1; y++) {
-    for (int x=1; x<grad_mag.cols-1; x++) {
-      // the gradient of current point
-      gx = grad_x.at<short>(y, x);
-      gy = grad_y.at<short>(y, x);
-      dTemp = grad_mag.at<uchar>(y, x);
-
-      // if gradient==0, then it is not the edge point
-      if (dTemp == 0) {
-        nmax_suppress.at<uchar>(y, x) = 0;
-      } else { // else check gradient direction
-        if (abs(gy) > abs(gx)) {
-          weight = fabs(gx) / fabs(gy);
-          g2 = grad_mag.at<uchar>(y-1, x);
-          g4 = grad_mag.at<uchar>(y+1, x);
-          if(gx*gy > 0) {
-            //g1 g2
-            //   C
-            //   g4 g3
-            g1 = grad_mag.at<uchar>(y-1, x-1);
-            g3 = grad_mag.at<uchar>(y+1, x+1);
-          } else { //  if(gx*gy < 0)
-            //    g2 g1
-            //    C
-            // g3 g4
-            g1 = grad_mag.at<uchar>(y-1, x+1);
-            g3 = grad_mag.at<uchar>(y+1, x-1);
-          }
-        }
-        else { // if (abs(gy) <= abs(gx))
-          weight = fabs(gy) / fabs(gx);
-          g2 = grad_mag.at<uchar>(y, x-1);
-          g4 = grad_mag.at<uchar>(y, x+1);
-          if(gx*gy > 0) {
-            // g1
-            // g2 C g4
-            //      g3
-            g1 = grad_mag.at<uchar>(y-1, x-1);
-            g3 = grad_mag.at<uchar>(y+1, x+1);
-          } else { // if(gx*gy < 0)
-            //      g3
-            // g2 C g4
-            // g1
-            g1 = grad_mag.at<uchar>(y+1, x-1);
-            g3 = grad_mag.at<uchar>(y-1, x+1);
-          }
+    scratch.Resize(buf.sobel_buf, MySobelBufSize(cols));
+    MySobelRows(src, buf.grad_x, buf.grad_y, g0, g1, &buf.sobel_buf[0], opts.sobel_simd, opts.border);
+  }
+
+  scratch.Create(buf.grad_mag, g1-g0, cols, opts.mag_depth);
+  {
+    MYCV_TRACE_SCOPE("magnitude", (int64)(g1-g0)*cols);
+    for (int y=g0; y<g1; y++)
+      GradMagnitudeRow(buf.grad_x.ptr<short>(y-g0), buf.grad_y.ptr<short>(y-g0), buf.grad_mag.ptr<uchar>(y-g0), cols,
+                       opts.L2gradient, opts.mag_depth, opts.simd);
+  }
+
+  MYCV_TRACE_SCOPE("nms", (int64)(n1-n0)*cols);
+  for (int y=n0; y<n1; y++) {
+    uchar* nms = nmax_suppress.ptr<uchar>(y-n0);
+    if (y == 0 || y == rows-1) { // boundary is not edge
+      memset(nms, 0, cols*nmax_suppress.elemSize());
+      continue;
+    }
+    NonMaxSuppressRow(buf.grad_mag.ptr<uchar>(y-1-g0), buf.grad_mag.ptr<uchar>(y-g0), buf.grad_mag.ptr<uchar>(y+1-g0),
+                      buf.grad_x.ptr<short>(y-g0), buf.grad_y.ptr<short>(y-g0), nms, cols, opts.mag_depth, opts.nms, opts.simd);
+  }
+  return g0;
+}
+
+// Edge rows [y0, y1) from NMS rows whose row 0 is image row n0.
+// Returns the number of weak+strong pixels left for edge tracking.
+static int EdgeRows(const Mat& nmax_suppress, int n0, Mat& detected_edges, int y0, int y1, int lo_threshold, int hi_threshold,
+                    const CannyOptions& opts)
+{
+  MYCV_TRACE_SCOPE("edge rows", (int64)(y1-y0)*detected_edges.cols);
+  int candidates = 0;
+  for (int y=y0; y<y1; y++) {
+    uchar* edges = detected_edges.ptr<uchar>(y);
+    if (y == 0 || y == detected_edges.rows-1) {
+      memset(edges, 0, detected_edges.cols);
+      continue;
+    }
+    candidates += EdgeRow(nmax_suppress.ptr<uchar>(y-1-n0), nmax_suppress.ptr<uchar>(y-n0), nmax_suppress.ptr<uchar>(y+1-n0),
+                          edges, detected_edges.cols, lo_threshold, hi_threshold, opts);
+  }
+  return candidates;
+}
+
+// Run every stage for the output rows [y0, y1). The band keeps a 2-row
+// halo of gradients and a 1-row halo of NMS in buf.
+// dbg_mag/dbg_nms, when not empty, receive the band's own rows of
+// magnitude and NMS for debug display.
+// Returns the number of weak+strong pixels left for edge tracking.
+static int CannyBand(const Mat& src, Mat& detected_edges, int y0, int y1, int lo_threshold, int hi_threshold,
+                      const CannyOptions& opts, CannyBandBuf& buf, ScratchBuf& scratch, Mat& dbg_mag, Mat& dbg_nms)
+{
+  int n0 = max(y0-1, 0), n1 = min(y1+1, src.rows); // NMS rows, 1-row halo
+  scratch.Create(buf.nmax_suppress, n1-n0, src.cols, opts.mag_depth);
+  int g0 = NmsRows(src, n0, n1, opts, buf, scratch, buf.nmax_suppress);
+
+  int candidates = EdgeRows(buf.nmax_suppress, n0, detected_edges, y0, y1, lo_threshold, hi_threshold, opts);
+
+  if (!dbg_mag.empty()) {
+    buf.grad_mag.rowRange(y0-g0, y1-g0).copyTo(dbg_mag.rowRange(y0, y1));
+    buf.nmax_suppress.rowRange(y0-n0, y1-n0).copyTo(dbg_nms.rowRange(y0, y1));
+  }
+  return candidates;
+}
+
+// Gradient and magnitude of image row y into the rings
+static void GradientRingRow(const Mat& src, int y, const CannyOptions& opts, CannyBandBuf& ring)
+{
+  short* grad_x = ring.grad_x.ptr<short>(y%3);
+  short* grad_y = ring.grad_y.ptr<short>(y%3);
+  if (opts.sobel == CANNY_SOBEL_OPENCV) {
+    Mat gx_row(1, src.cols, CV_16S, grad_x), gy_row(1, src.cols, CV_16S, grad_y);
+    Sobel(src.rowRange(y, y+1), gx_row, CV_16S, 1, 0, 3, 1, 0, BORDER_DEFAULT);
+    Sobel(src.rowRange(y, y+1), gy_row, CV_16S, 0, 1, 3, 1, 0, BORDER_DEFAULT);
+  } else {
+    MySobelRow(src, y, grad_x, grad_y, &ring.sobel_buf[0], opts.sobel_simd, opts.border);
+  }
+  GradMagnitudeRow(grad_x, grad_y, ring.grad_mag.ptr<uchar>(y%3), src.cols, opts.L2gradient, opts.mag_depth, opts.simd);
+}
+
+// Same result as CannyBand, but every row is produced just before it is
+// consumed: hysteresis row y pulls NMS up to row y+1, which pulls gradients
+// up to row y+2, so only the last 3 rows of each stage are kept. The
+// buffers of ring are 3-row rings, image row y lives in ring row y%3.
+static int CannyBandFused(const Mat& src, Mat& detected_edges, int y0, int y1, int lo_threshold, int hi_threshold,
+                           const CannyOptions& opts, CannyBandBuf& ring, ScratchBuf& scratch, Mat& dbg_mag, Mat& dbg_nms)
+{
+  MYCV_TRACE_SCOPE("canny fused", (int64)(y1-y0)*src.cols);
+  int rows = src.rows, cols = src.cols;
+  scratch.Create(ring.grad_x, 3, cols, CV_16S);
+  scratch.Create(ring.grad_y, 3, cols, CV_16S);
+  scratch.Create(ring.grad_mag, 3, cols, opts.mag_depth);
+  scratch.Create(ring.nmax_suppress, 3, cols, opts.mag_depth);
+  scratch.Resize(ring.sobel_buf, MySobelBufSize(cols));
+
+  int grad_next = max(y0-2, 0); // next gradient row to compute
+  int nms_next = max(y0-1, 0);  // next NMS row to compute
+  int candidates = 0;
+  for (int y=y0; y<y1; y++) {
+    uchar* edges = detected_edges.ptr<uchar>(y);
+    if (y == 0 || y == rows-1) { // boundary is not edge
+      memset(edges, 0, cols);
+      continue;
+    }
+    for (; nms_next <= y+1; nms_next++) {
+      int k = nms_next;
+      uchar* nms = ring.nmax_suppress.ptr<uchar>(k%3);
+      if (k == 0 || k == rows-1) {
+        memset(nms, 0, cols*ring.nmax_suppress.elemSize());
+      } else {
+        for (; grad_next <= k+1; grad_next++) {
+          GradientRingRow(src, grad_next, opts, ring);
+          if (!dbg_mag.empty() && grad_next >= y0 && grad_next < y1)
+            ring.grad_mag.row(grad_next%3).copyTo(dbg_mag.row(grad_next));
         }
+        NonMaxSuppressRow(ring.grad_mag.ptr<uchar>((k-1)%3), ring.grad_mag.ptr<uchar>(k%3), ring.grad_mag.ptr<uchar>((k+1)%3),
+                          ring.grad_x.ptr<short>(k%3), ring.grad_y.ptr<short>(k%3), nms, cols, opts.mag_depth, opts.nms, opts.simd);
       }
-      dTemp1 = weight*g1 + (1-weight)*g2;
-      dTemp2 = weight*g3 + (1-weight)*g4;	
-      if(dTemp>=dTemp1 && dTemp>=dTemp2) {
-        nmax_suppress.at<uchar>(y, x) = grad_mag.at<uchar>(y, x);
-      } else {
-        nmax_suppress.at<uchar>(y, x) = 0;
-      }			
+      if (!dbg_nms.empty() && k >= y0 && k < y1)
+        ring.nmax_suppress.row(k%3).copyTo(dbg_nms.row(k));
     }
+    candidates += EdgeRow(ring.nmax_suppress.ptr<uchar>((y-1)%3), ring.nmax_suppress.ptr<uchar>(y%3), ring.nmax_suppress.ptr<uchar>((y+1)%3),
+                          edges, cols, lo_threshold, hi_threshold, opts);
   }
+  return candidates;
+}
+
+// parallel_for_ body: each index of the range is one band. With edge
+// tracking the band also tracks inside its own rows and reports its
+// weak+strong count in candidates[band]. With an nms_map the band only
+// thresholds its rows of the map.
+class CannyBandBody : public ParallelLoopBody
+{
+public:
+  CannyBandBody(const Mat& src, const Mat& nms_map, Mat& detected_edges, int lo_threshold, int hi_threshold,
+                const CannyOptions& opts, int band_height, CannyBuf& buf, Mat& dbg_mag, Mat& dbg_nms) :
+    src(src), nms_map(nms_map), detected_edges(detected_edges), lo_threshold(lo_threshold), hi_threshold(hi_threshold),
+    opts(opts), band_height(band_height), buf(buf), dbg_mag(dbg_mag), dbg_nms(dbg_nms) {}
 
-  // Hysteresis threshold
-  for (int y=1; y<nmax_suppress.rows-1; y++) {
-    for (int x=1; x<nmax_suppress.cols-1; x++) {
-      if (nmax_suppress.at<uchar>(y, x) >= hi_threshold)
-        detected_edges.at<uchar>(y, x) = 255;
-      else if (nmax_suppress.at<uchar>(y, x) < lo_threshold)
-        detected_edges.at<uchar>(y, x) = 0;
+  void operator()(const Range& range) const
+  {
+    for (int b=range.start; b<range.end; b++) {
+      int y0 = b*band_height;
+      int y1 = min(y0+band_height, src.rows);
+      CannyBandBuf& band = buf.bands[b];
+      int& candidates = buf.candidates[b];
+      if (!nms_map.empty())
+        candidates = EdgeRows(nms_map, 0, detected_edges, y0, y1, lo_threshold, hi_threshold, opts);
+      else if (opts.fused)
+        candidates = CannyBandFused(src, detected_edges, y0, y1, lo_threshold, hi_threshold, opts, band, buf, dbg_mag, dbg_nms);
       else
-        if (nmax_suppress.at<uchar>(y-1, x-1) >= hi_threshold || nmax_suppress.at<uchar>(y-1, x) >= hi_threshold || nmax_suppress.at<uchar>(y-1, x+1) >= hi_threshold ||
-            nmax_suppress.at<uchar>(y  , x-1) >= hi_threshold ||                                                    nmax_suppress.at<uchar>(y  , x+1) >= hi_threshold ||
-            nmax_suppress.at<uchar>(y+1, x-1) >= hi_threshold || nmax_suppress.at<uchar>(y+1, x) >= hi_threshold || nmax_suppress.at<uchar>(y+1, x+1) >= hi_threshold)
-          detected_edges.at<uchar>(y, x) = 255;
-        else
-          detected_edges.at<uchar>(y, x) = 0;
+        candidates = CannyBand(src, detected_edges, y0, y1, lo_threshold, hi_threshold, opts, band, buf, dbg_mag, dbg_nms);
+      MYCV_TRACE_COUNT("edge candidates", candidates);
+      if (opts.hysteresis == CANNY_HYST_TRACE && candidates > 0) {
+        MYCV_TRACE_SCOPE("edge tracking", candidates);
+        buf.Resize(band.stack, candidates);
+        int sp = PushStrong(detected_edges, y0, y1, &band.stack[0], 0);
+        TraceEdges(detected_edges, y0, y1, &band.stack[0], sp);
+      }
     }
   }
+
+private:
+  const Mat& src;
+  const Mat& nms_map;
+  Mat& detected_edges;
+  int lo_threshold, hi_threshold;
+  const CannyOptions& opts;
+  int band_height;
+  CannyBuf& buf;
+  Mat& dbg_mag;
+  Mat& dbg_nms;
+};
+
+
+// parallel_for_ body of MyCannyNms: each index of the range is one band
+// of the NMS map, computed with its own halo of gradients
+class NmsBandBody : public ParallelLoopBody
+{
+public:
+  NmsBandBody(const Mat& src, Mat& nmax_suppress, const CannyOptions& opts, int band_height, CannyBuf& buf) :
+    src(src), nmax_suppress(nmax_suppress), opts(opts), band_height(band_height), buf(buf) {}
+
+  void operator()(const Range& range) const
+  {
+    for (int b=range.start; b<range.end; b++) {
+      int y0 = b*band_height;
+      int y1 = min(y0+band_height, src.rows);
+      Mat rows = nmax_suppress.rowRange(y0, y1);
+      NmsRows(src, y0, y1, opts, buf.bands[b], buf, rows);
+    }
+  }
+
+private:
+  const Mat& src;
+  Mat& nmax_suppress;
+  const CannyOptions& opts;
+  int band_height;
+  CannyBuf& buf;
+};
+
+// Threads of the tiled mode. They only bound parallel_for_'s stripes: the
+// process-wide cv::setNumThreads is never changed, so concurrent calls
+// with their own num_threads do not race on it.
+static int TiledThreads(const CannyOptions& opts)
+{
+  return opts.num_threads > 0 ? opts.num_threads : max(1, getNumThreads());
+}
+
+// about 4 bands per thread, unless opts sets the height
+static int BandHeight(int rows, int threads, const CannyOptions& opts)
+{
+  if (opts.band_height > 0)
+    return opts.band_height;
+  return max(16, (rows + 4*threads - 1) / (4*threads));
+}
+
+// MyCanny with all the stages, or only hysteresis when nms_map is not
+// empty (src then is nms_map). grad_mag/nmax_suppress: debug display.
+static void CannyEdges(const Mat& src, const Mat& nms_map, Mat& detected_edges, int lo_threshold, int hi_threshold,
+                       const CannyOptions& opts, CannyBuf& buf, Mat& grad_mag, Mat& nmax_suppress)
+{
+  if (opts.exec == CANNY_EXEC_TILED) {
+    int threads = TiledThreads(opts);
+    int band_height = BandHeight(src.rows, threads, opts);
+    int num_bands = (src.rows + band_height - 1) / band_height;
+    int stripes = min(num_bands, threads);
+    buf.Resize(buf.bands, num_bands);
+    buf.Resize(buf.candidates, num_bands);
+    parallel_for_(Range(0, num_bands),
+                  CannyBandBody(src, nms_map, detected_edges, lo_threshold, hi_threshold, opts, band_height, buf,
+                                grad_mag, nmax_suppress),
+                  stripes);
+
+    if (opts.hysteresis == CANNY_HYST_TRACE) {
+      // Merge across bands: continue tracking from the strong pixels on
+      // both sides of every band border, this time over the whole frame
+      MYCV_TRACE_SCOPE("edge tracking merge", (int64)src.total());
+      int total = 0;
+      for (int b=0; b<num_bands; b++)
+        total += buf.candidates[b];
+      if (total > 0) {
+        buf.Resize(buf.stack, total);
+        uchar** stack = &buf.stack[0];
+        int sp = 0, next_row = 0;
+        for (int b=1; b<num_bands; b++) {
+          int y = b*band_height;
+          sp = PushStrong(detected_edges, max(y-1, next_row), y+1, stack, sp);
+          next_row = y+1;
+        }
+        TraceEdges(detected_edges, 0, src.rows, stack, sp);
+      }
+      parallel_for_(Range(0, num_bands), DropWeakBody(detected_edges, band_height), stripes);
+    }
+  } else {
+    // one band covering the whole frame
+    buf.Resize(buf.bands, 1);
+    CannyBandBuf& band = buf.bands[0];
+    int candidates;
+    if (!nms_map.empty()) {
+      candidates = EdgeRows(nms_map, 0, detected_edges, 0, src.rows, lo_threshold, hi_threshold, opts);
+    } else if (opts.fused) {
+      candidates = CannyBandFused(src, detected_edges, 0, src.rows, lo_threshold, hi_threshold, opts, band, buf, grad_mag, nmax_suppress);
+    } else {
+      Mat no_dbg;
+      candidates = CannyBand(src, detected_edges, 0, src.rows, lo_threshold, hi_threshold, opts, band, buf, no_dbg, no_dbg);
+      grad_mag = band.grad_mag;
+      nmax_suppress = band.nmax_suppress;
+    }
+    MYCV_TRACE_COUNT("edge candidates", candidates);
+    if (opts.hysteresis == CANNY_HYST_TRACE) {
+      MYCV_TRACE_SCOPE("edge tracking", candidates);
+      if (candidates > 0) {
+        buf.Resize(buf.stack, candidates);
+        uchar** stack = &buf.stack[0];
+        int sp = PushStrong(detected_edges, 0, src.rows, stack, 0);
+        TraceEdges(detected_edges, 0, src.rows, stack, sp);
+      }
+      DropWeak(detected_edges, 0, src.rows);
+    }
+  }
+}
+
+/*
+ * @function MyCanny
+ * 1. Get Gradient's magnitude
+ * 2. Non-Maximum Suppression
+ * 3. hystersis threshold
+ */
+void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_threshold, const CannyOptions& opts,
+             CannyBuf& buf, bool debug)
+{
+  CV_Assert(opts.mag_depth == CV_8U || opts.mag_depth == CV_16U);
+  detected_edges.create(src.size(), CV_8U);
+  if (src.rows == 0 || src.cols == 0)
+    return;
+
+  Mat grad_mag, nmax_suppress; // for debug display only
+  if (debug && (opts.exec == CANNY_EXEC_TILED || opts.fused)) {
+    // bands and rings hand over their rows one by one
+    buf.Create(buf.dbg_mag, src.rows, src.cols, opts.mag_depth);
+    buf.Create(buf.dbg_nms, src.rows, src.cols, opts.mag_depth);
+    grad_mag = buf.dbg_mag;
+    nmax_suppress = buf.dbg_nms;
+    grad_mag.setTo(Scalar::all(0));
+    nmax_suppress.setTo(Scalar::all(0));
+  }
+  CannyEdges(src, Mat(), detected_edges, lo_threshold, hi_threshold, opts, buf, grad_mag, nmax_suppress);
+
 //// Just for comparation
 //   int otsu_val = otsu_threshold (nmax_suppress, detected_edges);
 //   cout << "otsu_threshold=" << otsu_val << endl;
@@ -178,10 +483,156 @@ void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_thres
 //   cout << "set threshold=" << th_val << endl;
 //   threshold(nmax_suppress, detected_edges, th_val, 255, THRESH_BINARY);
 
+#ifndef MYCV_NO_HIGHGUI
   if (debug) {
     imshow("MyCanny 1: Sobel gradient magnitude", grad_mag);
     imshow("MyCanny 2: Non-Maximum Suppression", nmax_suppress);
     imshow("MyCanny 3: Hysteresis threshold", detected_edges);
   }
+#endif
+}
+
+void MyCannyNms(const Mat& src, Mat& nmax_suppress, const CannyOptions& opts, CannyBuf& buf)
+{
+  CV_Assert(opts.mag_depth == CV_8U || opts.mag_depth == CV_16U);
+  buf.Create(nmax_suppress, src.rows, src.cols, opts.mag_depth);
+  if (src.rows == 0 || src.cols == 0)
+    return;
+  if (opts.exec == CANNY_EXEC_TILED) {
+    int threads = TiledThreads(opts);
+    int band_height = BandHeight(src.rows, threads, opts);
+    int num_bands = (src.rows + band_height - 1) / band_height;
+    buf.Resize(buf.bands, num_bands);
+    parallel_for_(Range(0, num_bands), NmsBandBody(src, nmax_suppress, opts, band_height, buf), min(num_bands, threads));
+  } else {
+    buf.Resize(buf.bands, 1);
+    NmsRows(src, 0, src.rows, opts, buf.bands[0], buf, nmax_suppress);
+  }
+}
+
+void MyCannyHysteresis(const Mat& nmax_suppress, Mat& detected_edges, int lo_threshold, int hi_threshold,
+                       const CannyOptions& opts, CannyBuf& buf)
+{
+  CV_Assert(nmax_suppress.depth() == opts.mag_depth && nmax_suppress.channels() == 1);
+  detected_edges.create(nmax_suppress.size(), CV_8U);
+  if (nmax_suppress.rows == 0 || nmax_suppress.cols == 0)
+    return;
+  Mat no_dbg;
+  CannyEdges(nmax_suppress, nmax_suppress, detected_edges, lo_threshold, hi_threshold, opts, buf, no_dbg, no_dbg);
+}
+
+template<typename MagT> static void CountSort(const Mat& nmax_suppress, CannyCandidates& cand)
+{
+  const int bins = (int)cand.hist.size();
+  int* hist = &cand.hist[0];
+  memset(hist, 0, bins*sizeof(int));
+  for (int y=0; y<nmax_suppress.rows; y++) {
+    const MagT* nms = nmax_suppress.ptr<MagT>(y);
+    for (int x=0; x<nmax_suppress.cols; x++)
+      hist[nms[x]]++;
+  }
+  // count_ge[t] = pixels >= t, and hist[v] becomes the first slot of value v
+  int* count_ge = &cand.count_ge[0];
+  count_ge[bins] = 0;
+  for (int v=bins-1; v>=0; v--)
+    count_ge[v] = count_ge[v+1] + hist[v];
+  for (int v=1; v<bins; v++)
+    hist[v] = count_ge[v+1];
+
+  cand.Resize(cand.offsets, count_ge[1]);
+  int* offsets = cand.offsets.empty() ? 0 : &cand.offsets[0];
+  for (int y=0; y<nmax_suppress.rows; y++) {
+    const MagT* nms = nmax_suppress.ptr<MagT>(y);
+    for (int x=0; x<nmax_suppress.cols; x++)
+      if (nms[x] != 0)
+        offsets[hist[nms[x]]++] = y*nmax_suppress.cols + x;
+  }
+}
+
+void MyCannySortCandidates(const Mat& nmax_suppress, CannyCandidates& cand)
+{
+  CV_Assert(nmax_suppress.type() == CV_8UC1 || nmax_suppress.type() == CV_16UC1);
+  MYCV_TRACE_SCOPE("sort candidates", (int64)nmax_suppress.total());
+  const int bins = nmax_suppress.depth() == CV_8U ? 256 : 65536;
+  cand.Resize(cand.hist, bins);
+  cand.Resize(cand.count_ge, bins+1);
+  if (nmax_suppress.depth() == CV_8U)
+    CountSort<uchar>(nmax_suppress, cand);
+  else
+    CountSort<ushort>(nmax_suppress, cand);
+
+  cand.Create(cand.edges, nmax_suppress.rows, nmax_suppress.cols, CV_8UC1);
+  cand.edges.setTo(Scalar::all(0));
+  cand.marked = 0;
+}
+
+// A weak pixel of the single pass needs a strong one among its 8 neighbours
+template<typename MagT> static bool StrongNeighbour(const Mat& nmax_suppress, int y, int x, int hi_threshold)
+{
+  const MagT* n0 = nmax_suppress.ptr<MagT>(y-1);
+  const MagT* n1 = nmax_suppress.ptr<MagT>(y);
+  const MagT* n2 = nmax_suppress.ptr<MagT>(y+1);
+  return n0[x-1] >= hi_threshold || n0[x] >= hi_threshold || n0[x+1] >= hi_threshold ||
+         n1[x-1] >= hi_threshold ||                          n1[x+1] >= hi_threshold ||
+         n2[x-1] >= hi_threshold || n2[x] >= hi_threshold || n2[x+1] >= hi_threshold;
+}
+
+void MyCannyHysteresis(const Mat& nmax_suppress, CannyCandidates& cand, int lo_threshold, int hi_threshold,
+                       CannyHysteresis hysteresis)
+{
+  CV_Assert(cand.edges.size() == nmax_suppress.size() && (int)cand.count_ge.size() > 1);
+  MYCV_TRACE_SCOPE("hysteresis sorted", 0);
+  Mat& edges = cand.edges;
+  uchar* data = edges.ptr<uchar>(0);
+  const int cols = edges.cols;
+  const int* offsets = cand.offsets.empty() ? 0 : &cand.offsets[0];
+  // edges is continuous (created by MyCannySortCandidates), offset y*cols+x is its pixel
+  for (int i=0; i<cand.marked; i++)
+    data[offsets[i]] = 0;
+
+  // candidates >= t are the prefix [0, count_ge[t]), NMS 0 is never a candidate
+  const int bins = (int)cand.count_ge.size() - 1;
+  int n_hi = cand.count_ge[min(max(hi_threshold, 1), bins)];
+  int n_lo = max(cand.count_ge[min(max(lo_threshold, 1), bins)], n_hi);
+  cand.marked = n_lo;
+  MYCV_TRACE_COUNT("edge candidates", n_lo);
+
+  for (int i=0; i<n_hi; i++)
+    data[offsets[i]] = 255;
+  if (hysteresis == CANNY_HYST_SINGLE_PASS) {
+    bool mag16 = nmax_suppress.depth() == CV_16U;
+    for (int i=n_hi; i<n_lo; i++) {
+      int y = offsets[i] / cols, x = offsets[i] - y*cols;
+      bool strong = mag16 ? StrongNeighbour<ushort>(nmax_suppress, y, x, hi_threshold)
+                          : StrongNeighbour<uchar>(nmax_suppress, y, x, hi_threshold);
+      data[offsets[i]] = strong ? 255 : 0;
+    }
+    return;
+  }
+
+  for (int i=n_hi; i<n_lo; i++)
+    data[offsets[i]] = 1;
+  if (n_lo > n_hi && n_hi > 0) {
+    cand.Resize(cand.stack, n_lo);
+    uchar** stack = &cand.stack[0];
+    for (int i=0; i<n_hi; i++)
+      stack[i] = data + offsets[i];
+    TraceEdges(edges, 0, edges.rows, stack, n_hi);
+  }
+  for (int i=n_hi; i<n_lo; i++)
+    if (data[offsets[i]] == 1)
+      data[offsets[i]] = 0;
 }
 
+void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_threshold, const CannyOptions& opts, bool debug)
+{
+  CannyBuf buf;
+  MyCanny(src, detected_edges, lo_threshold, hi_threshold, opts, buf, debug);
+}
+
+void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_threshold, bool L2gradient, bool debug)
+{
+  CannyOptions opts;
+  opts.L2gradient = L2gradient;
+  MyCanny(src, detected_edges, lo_threshold, hi_threshold, opts, debug);
+}
@@ -1,37 +1,188 @@
 // Convert color into gray scale.
 // Gray = R*0.299 + G*0.587 + B*0.114
 // w/o use float point.
+//   16.16 fixed point: (R*19595 + G*38469 + B*7472) >> 16, the weights add
+//   up to 65536. 38469 does not fit a signed 16-bit pmaddwd weight, so the
+//   SIMD paths use G*38469 = (G<<16) - G*27067.
+//   8-bit BGR/RGB: pshufb spreads 4 pixels into 32-bit lanes B,G,R,0,
+//   8-bit BGRA/RGBA already are such lanes. Then the even bytes (B,R) and
+//   odd bytes (G,A) are 16-bit pairs for pmaddwd.
+//   16-bit input: the same weights, >> 24 to get 8 bits.
+//   Gray 8-bit input is returned without copy (img shares src's data).
 //
 // By Steven Chen
 
-#include "define.hpp"
+#include "MyFilter.hpp"
 
 #include <iostream>
 using namespace std;
 
 #include <opencv2/opencv.hpp>
 using namespace cv;
- 
-void MyColorToGray(const Mat& src, Mat& img)
-{
-  if (src.channels() == 3) {
-    /// Convert the image to grayscale
-    #ifdef OCV_CVTCOLOR
-      cvtColor( src, img, CV_BGR2GRAY );
-
-    #else
-      for (int y=0; y<img.rows; y++)
-        for (int x=0; x<img.cols; x++) {
-          uchar B = src.at<Vec3b>(y, x)[0];
-          uchar G = src.at<Vec3b>(y, x)[1];
-          uchar R = src.at<Vec3b>(y, x)[2];
-          // img.at<uchar>(y, x) = R*0.299 + G*0.587 + B*0.114;
-          img.at<uchar>(y, x) = ((uint)R*19595 + (uint)G*38469 + (uint)B*7472) >> 16;
-        }
-    #endif
-  } else {
-    img = src.clone();
+
+static const int W_R = 19595, W_G = 38469, W_B = 7472;
+
+// cn: 3 or 4 channels, rgb: channel 0 is R instead of B
+template<typename T> static void ColorToGrayRow_Scalar(const T* src, uchar* dst, int x, int cols, int cn, bool rgb)
+{
+  const int shift = sizeof(T) == 1 ? 16 : 24;
+  const uint w0 = rgb ? W_R : W_B, w2 = rgb ? W_B : W_R;
+  for (src += x*cn; x<cols; x++, src += cn)
+    dst[x] = (uchar)((src[0]*w0 + src[1]*(uint)W_G + src[2]*w2) >> shift);
+}
+
+static void GrayToGrayRow_16U(const ushort* src, uchar* dst, int cols)
+{
+  for (int x=0; x<cols; x++)
+    dst[x] = (uchar)(src[x] >> 8);
+}
+
+#ifdef MYCV_X86
+// 4 pixels of 32-bit lanes (c0, G, c2, x) -> 4 gray values in 32-bit lanes
+static inline __m128i Gray4_SSE2(__m128i px, __m128i w02, __m128i wg)
+{
+  const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+  __m128i even = _mm_and_si128(px, mask);                    // c0 | c2<<16
+  __m128i odd  = _mm_and_si128(_mm_srli_epi32(px, 8), mask); // G  | x<<16
+  __m128i s = _mm_add_epi32(_mm_madd_epi16(even, w02), _mm_madd_epi16(odd, wg));
+  return _mm_srli_epi32(_mm_add_epi32(s, _mm_slli_epi32(odd, 16)), 16);
+}
+
+static inline void StoreGray16_SSE2(uchar* dst, const __m128i g[4])
+{
+  _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3])));
+}
+
+static void ColorToGrayRow4_SSE2(const uchar* src, uchar* dst, int cols, bool rgb)
+{
+  const __m128i w02 = rgb ? _mm_set1_epi32((W_B << 16) | W_R) : _mm_set1_epi32((W_R << 16) | W_B);
+  const __m128i wg  = _mm_set1_epi32((W_G - 65536) & 0xffff); // (G, x) pairs, x weighted 0
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m128i g[4];
+    for (int i=0; i<4; i++)
+      g[i] = Gray4_SSE2(_mm_loadu_si128((const __m128i*)(src + 4*(x+4*i))), w02, wg);
+    StoreGray16_SSE2(dst+x, g);
+  }
+  ColorToGrayRow_Scalar(src, dst, x, cols, 4, rgb);
+}
+
+// 4 pixels B,G,R of 12 bytes -> 32-bit lanes B,G,R,0
+MYCV_TARGET_SSSE3
+static void ColorToGrayRow3_SSSE3(const uchar* src, uchar* dst, int cols, bool rgb)
+{
+  const __m128i w02 = rgb ? _mm_set1_epi32((W_B << 16) | W_R) : _mm_set1_epi32((W_R << 16) | W_B);
+  const __m128i wg  = _mm_set1_epi32((W_G - 65536) & 0xffff); // (G, x) pairs, x weighted 0
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  int x = 0;
+  // the last 16-byte load of a block reads 4 bytes past its 16th pixel
+  for (; x <= cols-18; x += 16) {
+    __m128i g[4];
+    for (int i=0; i<4; i++)
+      g[i] = Gray4_SSE2(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3*(x+4*i))), spread), w02, wg);
+    StoreGray16_SSE2(dst+x, g);
+  }
+  ColorToGrayRow_Scalar(src, dst, x, cols, 3, rgb);
+}
+
+MYCV_TARGET_AVX2
+static inline __m256i Gray8_AVX2(__m256i px, __m256i w02, __m256i wg)
+{
+  const __m256i mask = _mm256_set1_epi32(0x00ff00ff);
+  __m256i even = _mm256_and_si256(px, mask);
+  __m256i odd  = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+  __m256i s = _mm256_add_epi32(_mm256_madd_epi16(even, w02), _mm256_madd_epi16(odd, wg));
+  return _mm256_srli_epi32(_mm256_add_epi32(s, _mm256_slli_epi32(odd, 16)), 16);
+}
+
+// g[i] holds pixels 8i..8i+7; the in-lane packs interleave 4-pixel groups, the permute restores the order
+MYCV_TARGET_AVX2
+static inline void StoreGray32_AVX2(uchar* dst, const __m256i g[4])
+{
+  __m256i v = _mm256_packus_epi16(_mm256_packs_epi32(g[0], g[1]), _mm256_packs_epi32(g[2], g[3]));
+  _mm256_storeu_si256((__m256i*)dst, _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+}
+
+MYCV_TARGET_AVX2
+static void ColorToGrayRow4_AVX2(const uchar* src, uchar* dst, int cols, bool rgb)
+{
+  const __m256i w02 = rgb ? _mm256_set1_epi32((W_B << 16) | W_R) : _mm256_set1_epi32((W_R << 16) | W_B);
+  const __m256i wg  = _mm256_set1_epi32((W_G - 65536) & 0xffff);
+  int x = 0;
+  for (; x <= cols-32; x += 32) {
+    __m256i g[4];
+    for (int i=0; i<4; i++)
+      g[i] = Gray8_AVX2(_mm256_loadu_si256((const __m256i*)(src + 4*(x+8*i))), w02, wg);
+    StoreGray32_AVX2(dst+x, g);
+  }
+  ColorToGrayRow_Scalar(src, dst, x, cols, 4, rgb);
+}
+
+MYCV_TARGET_AVX2
+static void ColorToGrayRow3_AVX2(const uchar* src, uchar* dst, int cols, bool rgb)
+{
+  const __m256i w02 = rgb ? _mm256_set1_epi32((W_B << 16) | W_R) : _mm256_set1_epi32((W_R << 16) | W_B);
+  const __m256i wg  = _mm256_set1_epi32((W_G - 65536) & 0xffff);
+  const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  int x = 0;
+  for (; x <= cols-34; x += 32) {
+    __m256i g[4];
+    for (int i=0; i<4; i++) {
+      const uchar* p = src + 3*(x+8*i);
+      __m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+                                           _mm_loadu_si128((const __m128i*)(p+12)), 1);
+      g[i] = Gray8_AVX2(_mm256_shuffle_epi8(px, spread), w02, wg);
+    }
+    StoreGray32_AVX2(dst+x, g);
   }
+  ColorToGrayRow_Scalar(src, dst, x, cols, 3, rgb);
 }
+#endif
 
+static void ColorToGrayRow_8U(const uchar* src, uchar* dst, int cols, int cn, bool rgb, SimdPath simd)
+{
+  switch (simd) {
+#ifdef MYCV_X86
+    case SIMD_AVX2:
+      if (cn == 4) ColorToGrayRow4_AVX2(src, dst, cols, rgb);
+      else         ColorToGrayRow3_AVX2(src, dst, cols, rgb);
+      break;
+    case SIMD_SSE2:
+      if (cn == 4)
+        ColorToGrayRow4_SSE2(src, dst, cols, rgb);
+      else if (cv::checkHardwareSupport(CV_CPU_SSSE3))
+        ColorToGrayRow3_SSSE3(src, dst, cols, rgb);
+      else
+        ColorToGrayRow_Scalar(src, dst, 0, cols, cn, rgb);
+      break;
+#endif
+    default:
+      ColorToGrayRow_Scalar(src, dst, 0, cols, cn, rgb);
+      break;
+  }
+}
 
+void MyColorToGray(const Mat& src, Mat& img, bool rgb, SimdPath simd)
+{
+  CV_Assert(src.depth() == CV_8U || src.depth() == CV_16U);
+  CV_Assert(src.channels() == 1 || src.channels() == 3 || src.channels() == 4);
+  MYCV_TRACE_SCOPE("gray", (int64)src.total());
+  if (src.type() == CV_8UC1) {
+    img = src; // already gray, no copy
+    return;
+  }
+  const int cn = src.channels();
+  /// Convert the image to grayscale
+  img.create(src.size(), CV_8UC1);
+  simd = ResolveSimdPath(simd);
+  for (int y=0; y<src.rows; y++) {
+    uchar* dst = img.ptr<uchar>(y);
+    if (src.depth() == CV_8U)
+      ColorToGrayRow_8U(src.ptr<uchar>(y), dst, src.cols, cn, rgb, simd);
+    else if (cn == 1)
+      GrayToGrayRow_16U(src.ptr<ushort>(y), dst, src.cols);
+    else
+      ColorToGrayRow_Scalar(src.ptr<ushort>(y), dst, 0, src.cols, cn, rgb);
+  }
+}
@@ -0,0 +1,206 @@
+/*
+  Topic: Sobel gradient for Canny Edge Detection
+
+ * @function MySobel
+ *   The 3x3 Sobel kernels are separable:
+ *     Gx = [1 2 1]' * [-1 0 1]    Gy = [-1 0 1]' * [1 2 1]
+ *   so every row is done in two passes over raw row pointers:
+ *   1. vertical:   vs = r0 + 2*r1 + r2,  vd = r2 - r0  (one pass for both)
+ *   2. horizontal: gx = vs[x+1] - vs[x-1],  gy = vd[x-1] + 2*vd[x] + vd[x+1]
+ *   The image border is handled in the row buffers (FilterBorder.hpp,
+ *   replicated by default), the frame is read in place with its stride.
+ *   All paths use 16-bit integer math,
+ *   so SSE2/AVX2 output is bit-identical to the scalar fallback.
+
+  Author: Steven Chen
+*/
+
+#include "MyCanny.hpp"
+
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+// Border columns of the vertical sums: the vs/vd index of the source
+// column they map to, or -1 for BORDER_CONSTANT (vs = 4*value, vd = 0)
+struct SobelColumns {
+  int left, right;
+  short vs_value;
+  SobelColumns(int cols, const FilterBorder& border) :
+    left(border.Index(-1, cols)), right(border.Index(cols, cols)), vs_value((short)(4*border.value))
+  {
+    left += left >= 0;
+    right += right >= 0;
+  }
+};
+
+// vs/vd hold cols+2 elements: [0] and [cols+1] are the border columns
+static inline void SobelBorderColumns(short* vs, short* vd, int cols, const SobelColumns& bc)
+{
+  vs[0] = bc.left < 0 ? bc.vs_value : vs[bc.left];
+  vd[0] = bc.left < 0 ? 0 : vd[bc.left];
+  vs[cols+1] = bc.right < 0 ? bc.vs_value : vs[bc.right];
+  vd[cols+1] = bc.right < 0 ? 0 : vd[bc.right];
+}
+
+static void SobelRow_Scalar(const uchar* r0, const uchar* r1, const uchar* r2,
+                            short* gx, short* gy, short* vs, short* vd, int cols, const SobelColumns& bc)
+{
+  for (int x=0; x<cols; x++) {
+    vs[x+1] = (short)(r0[x] + 2*r1[x] + r2[x]);
+    vd[x+1] = (short)(r2[x] - r0[x]);
+  }
+  SobelBorderColumns(vs, vd, cols, bc);
+
+  for (int x=0; x<cols; x++) {
+    gx[x] = (short)(vs[x+2] - vs[x]);
+    gy[x] = (short)(vd[x] + 2*vd[x+1] + vd[x+2]);
+  }
+}
+
+#ifdef MYCV_X86
+static void SobelRow_SSE2(const uchar* r0, const uchar* r1, const uchar* r2,
+                          short* gx, short* gy, short* vs, short* vd, int cols, const SobelColumns& bc)
+{
+  const __m128i z = _mm_setzero_si128();
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(r0+x));
+    __m128i b = _mm_loadu_si128((const __m128i*)(r1+x));
+    __m128i c = _mm_loadu_si128((const __m128i*)(r2+x));
+    __m128i a0 = _mm_unpacklo_epi8(a, z), a1 = _mm_unpackhi_epi8(a, z);
+    __m128i b0 = _mm_unpacklo_epi8(b, z), b1 = _mm_unpackhi_epi8(b, z);
+    __m128i c0 = _mm_unpacklo_epi8(c, z), c1 = _mm_unpackhi_epi8(c, z);
+    _mm_storeu_si128((__m128i*)(vs+x+1), _mm_add_epi16(_mm_add_epi16(a0, c0), _mm_slli_epi16(b0, 1)));
+    _mm_storeu_si128((__m128i*)(vs+x+9), _mm_add_epi16(_mm_add_epi16(a1, c1), _mm_slli_epi16(b1, 1)));
+    _mm_storeu_si128((__m128i*)(vd+x+1), _mm_sub_epi16(c0, a0));
+    _mm_storeu_si128((__m128i*)(vd+x+9), _mm_sub_epi16(c1, a1));
+  }
+  for (; x<cols; x++) {
+    vs[x+1] = (short)(r0[x] + 2*r1[x] + r2[x]);
+    vd[x+1] = (short)(r2[x] - r0[x]);
+  }
+  SobelBorderColumns(vs, vd, cols, bc);
+
+  x = 0;
+  for (; x <= cols-8; x += 8) {
+    __m128i sl = _mm_loadu_si128((const __m128i*)(vs+x));
+    __m128i sr = _mm_loadu_si128((const __m128i*)(vs+x+2));
+    __m128i dl = _mm_loadu_si128((const __m128i*)(vd+x));
+    __m128i dc = _mm_loadu_si128((const __m128i*)(vd+x+1));
+    __m128i dr = _mm_loadu_si128((const __m128i*)(vd+x+2));
+    _mm_storeu_si128((__m128i*)(gx+x), _mm_sub_epi16(sr, sl));
+    _mm_storeu_si128((__m128i*)(gy+x), _mm_add_epi16(_mm_add_epi16(dl, dr), _mm_slli_epi16(dc, 1)));
+  }
+  for (; x<cols; x++) {
+    gx[x] = (short)(vs[x+2] - vs[x]);
+    gy[x] = (short)(vd[x] + 2*vd[x+1] + vd[x+2]);
+  }
+}
+
+MYCV_TARGET_AVX2
+static void SobelRow_AVX2(const uchar* r0, const uchar* r1, const uchar* r2,
+                          short* gx, short* gy, short* vs, short* vd, int cols, const SobelColumns& bc)
+{
+  int x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(r0+x)));
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(r1+x)));
+    __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(r2+x)));
+    _mm256_storeu_si256((__m256i*)(vs+x+1), _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1)));
+    _mm256_storeu_si256((__m256i*)(vd+x+1), _mm256_sub_epi16(c, a));
+  }
+  for (; x<cols; x++) {
+    vs[x+1] = (short)(r0[x] + 2*r1[x] + r2[x]);
+    vd[x+1] = (short)(r2[x] - r0[x]);
+  }
+  SobelBorderColumns(vs, vd, cols, bc);
+
+  x = 0;
+  for (; x <= cols-16; x += 16) {
+    __m256i sl = _mm256_loadu_si256((const __m256i*)(vs+x));
+    __m256i sr = _mm256_loadu_si256((const __m256i*)(vs+x+2));
+    __m256i dl = _mm256_loadu_si256((const __m256i*)(vd+x));
+    __m256i dc = _mm256_loadu_si256((const __m256i*)(vd+x+1));
+    __m256i dr = _mm256_loadu_si256((const __m256i*)(vd+x+2));
+    _mm256_storeu_si256((__m256i*)(gx+x), _mm256_sub_epi16(sr, sl));
+    _mm256_storeu_si256((__m256i*)(gy+x), _mm256_add_epi16(_mm256_add_epi16(dl, dr), _mm256_slli_epi16(dc, 1)));
+  }
+  for (; x<cols; x++) {
+    gx[x] = (short)(vs[x+2] - vs[x]);
+    gy[x] = (short)(vd[x] + 2*vd[x+1] + vd[x+2]);
+  }
+}
+#endif
+
+typedef void (*SobelRowFunc)(const uchar*, const uchar*, const uchar*, short*, short*, short*, short*, int,
+                             const SobelColumns&);
+
+static SobelRowFunc GetSobelRowFunc(SimdPath simd)
+{
+  switch (ResolveSimdPath(simd)) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: return SobelRow_AVX2;
+    case SIMD_SSE2: return SobelRow_SSE2;
+#endif
+    default:        return SobelRow_Scalar;
+  }
+}
+
+// Rows y-1 and y+1 of src; outside a BORDER_CONSTANT image a row of the
+// constant, kept in the last cols+2 shorts of buf
+static void SobelNeighbourRows(const Mat& src, int y, const FilterBorder& border, short* buf,
+                               const uchar*& r0, const uchar*& r2)
+{
+  uchar* constant_row = 0;
+  if (border.type == BORDER_CONSTANT && (y == 0 || y == src.rows-1)) {
+    constant_row = (uchar*)(buf + 2*(src.cols+2));
+    memset(constant_row, border.value, src.cols);
+  }
+  r0 = border.Row(src, y-1, constant_row);
+  r2 = border.Row(src, y+1, constant_row);
+}
+
+void MySobelRow(const Mat& src, int y, short* grad_x, short* grad_y, short* buf, SimdPath simd, const FilterBorder& border)
+{
+  const uchar *r0, *r2;
+  SobelNeighbourRows(src, y, border, buf, r0, r2);
+  GetSobelRowFunc(simd)(r0, src.ptr<uchar>(y), r2, grad_x, grad_y, buf, buf + src.cols+2, src.cols,
+                        SobelColumns(src.cols, border));
+}
+
+void MySobelRows(const Mat& src, Mat& grad_x, Mat& grad_y, int y0, int y1, short* buf, SimdPath simd,
+                 const FilterBorder& border)
+{
+  grad_x.create(y1-y0, src.cols, CV_16S);
+  grad_y.create(y1-y0, src.cols, CV_16S);
+  if (y1 <= y0 || src.cols == 0)
+    return;
+
+  MYCV_TRACE_SCOPE("sobel", (int64)(y1-y0)*src.cols);
+  SobelRowFunc sobel_row = GetSobelRowFunc(simd);
+  short* vs = buf;
+  short* vd = vs + src.cols+2;
+  SobelColumns bc(src.cols, border);
+
+  // Calculate Gx/Gy gradient, rows -1 and rows come from the border
+  for (int y=y0; y<y1; y++) {
+    const uchar *r0, *r2;
+    SobelNeighbourRows(src, y, border, buf, r0, r2);
+    sobel_row(r0, src.ptr<uchar>(y), r2, grad_x.ptr<short>(y-y0), grad_y.ptr<short>(y-y0), vs, vd, src.cols, bc);
+  }
+}
+
+void MySobelRows(const Mat& src, Mat& grad_x, Mat& grad_y, int y0, int y1, SimdPath simd, const FilterBorder& border)
+{
+  vector<short> vbuf(MySobelBufSize(src.cols));
+  MySobelRows(src, grad_x, grad_y, y0, y1, &vbuf[0], simd, border);
+}
+
+void MySobel (const Mat& src, Mat& grad_x, Mat& grad_y, SimdPath simd, const FilterBorder& border)
+{
+  MySobelRows(src, grad_x, grad_y, 0, src.rows, simd, border);
+}
@@ -0,0 +1,245 @@
+/*
+  Topic: Non-Maximum Suppression for Canny Edge Detection
+
+ * @function NonMaxSuppressRow
+ *   A pixel is kept when its magnitude is >= both neighbours along the
+ *   gradient direction, otherwise it is set to 0. Row borders are 0.
+ *   CANNY_NMS_INTERPOLATED: the neighbours are interpolated between the
+ *       two closest pixels with weight min(|gx|,|gy|)/max(|gx|,|gy|).
+ *   CANNY_NMS_QUANTIZED: the direction is quantized into 4 bins
+ *       (0, 45, 90, 135 degrees) with integer tangent compares
+ *         horizontal: |gy|*2^15 < |gx|*TG22
+ *         vertical:   |gx|*2^15 < |gy|*TG22
+ *         diagonal:   otherwise, the sign of gx*gy picks 45 or 135
+ *       TG22 = tan(22.5)*2^15. No divides, the neighbours come from a
+ *       table, and the SSE2/AVX2 paths select them with masks.
+
+  Author: Steven Chen
+*/
+
+#include "MyCanny.hpp"
+
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+static const int TG22 = 13573; // (int)(tan(22.5 deg) * (1<<15) + 0.5)
+
+// m0/m1/m2: magnitude of rows y-1, y, y+1
+template<typename MagT> static void NmsRow_Interpolated(const MagT* m0, const MagT* m1, const MagT* m2,
+                                                        const short* grad_x, const short* grad_y, MagT* nmax_suppress, int cols)
+{
+  short gx, gy;
+  int g1, g2, g3, g4;
+  double dTemp, dTemp1, dTemp2;
+  double weight;
+  nmax_suppress[0] = nmax_suppress[cols-1] = 0; // boundary is not edge
+  for (int x=1; x<cols-1; x++) {
+    // the gradient of current point
+    gx = grad_x[x];
+    gy = grad_y[x];
+    dTemp = m1[x];
+
+    // if gradient==0, then it is not the edge point
+    if (dTemp == 0) {
+      nmax_suppress[x] = 0;
+      continue;
+    }
+    // else check gradient direction
+    if (abs(gy) > abs(gx)) {
+      weight = fabs(gx) / fabs(gy);
+      g2 = m0[x];
+      g4 = m2[x];
+      if(gx*gy > 0) {
+        //g1 g2
+        //   C
+        //   g4 g3
+        g1 = m0[x-1];
+        g3 = m2[x+1];
+      } else { //  if(gx*gy < 0)
+        //    g2 g1
+        //    C
+        // g3 g4
+        g1 = m0[x+1];
+        g3 = m2[x-1];
+      }
+    }
+    else { // if (abs(gy) <= abs(gx))
+      weight = fabs(gy) / fabs(gx);
+      g2 = m1[x-1];
+      g4 = m1[x+1];
+      if(gx*gy > 0) {
+        // g1
+        // g2 C g4
+        //      g3
+        g1 = m0[x-1];
+        g3 = m2[x+1];
+      } else { // if(gx*gy < 0)
+        //      g3
+        // g2 C g4
+        // g1
+        g1 = m2[x-1];
+        g3 = m0[x+1];
+      }
+    }
+    dTemp1 = weight*g1 + (1-weight)*g2;
+    dTemp2 = weight*g3 + (1-weight)*g4;
+    if(dTemp>=dTemp1 && dTemp>=dTemp2) {
+      nmax_suppress[x] = m1[x];
+    } else {
+      nmax_suppress[x] = 0;
+    }
+  }
+}
+
+// The two neighbours (row offset, column offset) of every direction bin
+static const int nms_neighbours[4][2][2] = {
+  { { 0, -1}, { 0,  1} }, // 0: horizontal gradient
+  { {-1, -1}, { 1,  1} }, // 1: gx*gy > 0, down-right
+  { {-1,  0}, { 1,  0} }, // 2: vertical gradient
+  { {-1,  1}, { 1, -1} }  // 3: gx*gy < 0, down-left
+};
+
+template<typename MagT> static void NmsRow_Quantized(const MagT* m0, const MagT* m1, const MagT* m2,
+                                                     const short* grad_x, const short* grad_y, MagT* nmax_suppress,
+                                                     int x, int cols)
+{
+  const MagT* rows[3] = { m0, m1, m2 };
+  for (; x<cols-1; x++) {
+    int ax = abs(grad_x[x]), ay = abs(grad_y[x]);
+    int horiz = (ay << 15) < ax*TG22;
+    int vert  = (ax << 15) < ay*TG22;
+    int neg   = (grad_x[x] ^ grad_y[x]) < 0;
+    int diag  = 1 - (horiz | vert);
+    int bin   = 2*vert + diag*(1 + 2*neg);
+    const int (*nb)[2] = nms_neighbours[bin];
+    int m = m1[x];
+    int keep = (m >= rows[1+nb[0][0]][x+nb[0][1]]) & (m >= rows[1+nb[1][0]][x+nb[1][1]]);
+    nmax_suppress[x] = (MagT)(m & -keep);
+  }
+  nmax_suppress[cols-1] = 0;
+}
+
+#ifdef MYCV_X86
+// 8 magnitudes widened to 16-bit lanes
+static inline __m128i LoadMag8(const uchar* p)  { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+static inline __m128i LoadMag8(const ushort* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void StoreMag8(uchar* p, __m128i v)  { _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v)); }
+static inline void StoreMag8(ushort* p, __m128i v) { _mm_storeu_si128((__m128i*)p, v); }
+
+static inline __m128i Select_SSE2(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Magnitudes fit in 15 bits, so the signed 16-bit compares are safe
+template<typename MagT> static void NmsRow_Quantized_SSE2(const MagT* m0, const MagT* m1, const MagT* m2,
+                                                          const short* grad_x, const short* grad_y, MagT* nmax_suppress, int cols)
+{
+  const __m128i k_horiz = _mm_set_epi16(-32768, TG22, -32768, TG22, -32768, TG22, -32768, TG22); // ax*TG22 - ay*2^15
+  const __m128i k_vert  = _mm_set_epi16(TG22, -32768, TG22, -32768, TG22, -32768, TG22, -32768); // ay*TG22 - ax*2^15
+  const __m128i zero = _mm_setzero_si128();
+  nmax_suppress[0] = 0;
+  int x = 1;
+  for (; x <= cols-9; x += 8) {
+    __m128i gx = _mm_loadu_si128((const __m128i*)(grad_x+x));
+    __m128i gy = _mm_loadu_si128((const __m128i*)(grad_y+x));
+    __m128i ax = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+    __m128i ay = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+    __m128i lo = _mm_unpacklo_epi16(ax, ay), hi = _mm_unpackhi_epi16(ax, ay);
+    __m128i horiz = _mm_packs_epi32(_mm_cmpgt_epi32(_mm_madd_epi16(lo, k_horiz), zero),
+                                    _mm_cmpgt_epi32(_mm_madd_epi16(hi, k_horiz), zero));
+    __m128i vert  = _mm_packs_epi32(_mm_cmpgt_epi32(_mm_madd_epi16(lo, k_vert), zero),
+                                    _mm_cmpgt_epi32(_mm_madd_epi16(hi, k_vert), zero));
+    __m128i neg   = _mm_srai_epi16(_mm_xor_si128(gx, gy), 15);
+
+    // diagonal neighbours first, then overridden by vertical and horizontal
+    __m128i a = Select_SSE2(neg, LoadMag8(m0+x+1), LoadMag8(m0+x-1));
+    __m128i b = Select_SSE2(neg, LoadMag8(m2+x-1), LoadMag8(m2+x+1));
+    a = Select_SSE2(vert, LoadMag8(m0+x), a);
+    b = Select_SSE2(vert, LoadMag8(m2+x), b);
+    a = Select_SSE2(horiz, LoadMag8(m1+x-1), a);
+    b = Select_SSE2(horiz, LoadMag8(m1+x+1), b);
+
+    __m128i m = LoadMag8(m1+x);
+    __m128i drop = _mm_or_si128(_mm_cmpgt_epi16(a, m), _mm_cmpgt_epi16(b, m));
+    StoreMag8(nmax_suppress+x, _mm_andnot_si128(drop, m));
+  }
+  NmsRow_Quantized(m0, m1, m2, grad_x, grad_y, nmax_suppress, x, cols);
+}
+
+MYCV_TARGET_AVX2 static inline __m256i LoadMag16(const uchar* p)  { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+MYCV_TARGET_AVX2 static inline __m256i LoadMag16(const ushort* p) { return _mm256_loadu_si256((const __m256i*)p); }
+MYCV_TARGET_AVX2 static inline void StoreMag16(uchar* p, __m256i v)
+{
+  _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08)));
+}
+MYCV_TARGET_AVX2 static inline void StoreMag16(ushort* p, __m256i v) { _mm256_storeu_si256((__m256i*)p, v); }
+
+// unpack/madd/pack all stay inside 128-bit lanes, so the pixel order is kept
+template<typename MagT> MYCV_TARGET_AVX2
+static void NmsRow_Quantized_AVX2(const MagT* m0, const MagT* m1, const MagT* m2,
+                                  const short* grad_x, const short* grad_y, MagT* nmax_suppress, int cols)
+{
+  const __m256i k_horiz = _mm256_set1_epi32((int)((unsigned)TG22 | 0x80000000u));        // (TG22, -32768) pairs
+  const __m256i k_vert  = _mm256_set1_epi32((int)(((unsigned)TG22 << 16) | 0x8000u));    // (-32768, TG22) pairs
+  const __m256i zero = _mm256_setzero_si256();
+  nmax_suppress[0] = 0;
+  int x = 1;
+  for (; x <= cols-17; x += 16) {
+    __m256i gx = _mm256_loadu_si256((const __m256i*)(grad_x+x));
+    __m256i gy = _mm256_loadu_si256((const __m256i*)(grad_y+x));
+    __m256i ax = _mm256_abs_epi16(gx), ay = _mm256_abs_epi16(gy);
+    __m256i lo = _mm256_unpacklo_epi16(ax, ay), hi = _mm256_unpackhi_epi16(ax, ay);
+    __m256i horiz = _mm256_packs_epi32(_mm256_cmpgt_epi32(_mm256_madd_epi16(lo, k_horiz), zero),
+                                       _mm256_cmpgt_epi32(_mm256_madd_epi16(hi, k_horiz), zero));
+    __m256i vert  = _mm256_packs_epi32(_mm256_cmpgt_epi32(_mm256_madd_epi16(lo, k_vert), zero),
+                                       _mm256_cmpgt_epi32(_mm256_madd_epi16(hi, k_vert), zero));
+    __m256i neg   = _mm256_srai_epi16(_mm256_xor_si256(gx, gy), 15);
+
+    __m256i a = _mm256_blendv_epi8(LoadMag16(m0+x-1), LoadMag16(m0+x+1), neg);
+    __m256i b = _mm256_blendv_epi8(LoadMag16(m2+x+1), LoadMag16(m2+x-1), neg);
+    a = _mm256_blendv_epi8(a, LoadMag16(m0+x), vert);
+    b = _mm256_blendv_epi8(b, LoadMag16(m2+x), vert);
+    a = _mm256_blendv_epi8(a, LoadMag16(m1+x-1), horiz);
+    b = _mm256_blendv_epi8(b, LoadMag16(m1+x+1), horiz);
+
+    __m256i m = LoadMag16(m1+x);
+    __m256i drop = _mm256_or_si256(_mm256_cmpgt_epi16(a, m), _mm256_cmpgt_epi16(b, m));
+    StoreMag16(nmax_suppress+x, _mm256_andnot_si256(drop, m));
+  }
+  NmsRow_Quantized(m0, m1, m2, grad_x, grad_y, nmax_suppress, x, cols);
+}
+#endif
+
+template<typename MagT> static void NmsRow(const MagT* m0, const MagT* m1, const MagT* m2,
+                                           const short* grad_x, const short* grad_y, MagT* nmax_suppress, int cols,
+                                           CannyNms mode, SimdPath simd)
+{
+  if (mode == CANNY_NMS_INTERPOLATED) {
+    NmsRow_Interpolated(m0, m1, m2, grad_x, grad_y, nmax_suppress, cols);
+    return;
+  }
+  switch (ResolveSimdPath(simd)) {
+#ifdef MYCV_X86
+    case SIMD_AVX2: NmsRow_Quantized_AVX2(m0, m1, m2, grad_x, grad_y, nmax_suppress, cols); break;
+    case SIMD_SSE2: NmsRow_Quantized_SSE2(m0, m1, m2, grad_x, grad_y, nmax_suppress, cols); break;
+#endif
+    default:
+      nmax_suppress[0] = 0;
+      NmsRow_Quantized(m0, m1, m2, grad_x, grad_y, nmax_suppress, 1, cols);
+      break;
+  }
+}
+
+void NonMaxSuppressRow(const uchar* m0, const uchar* m1, const uchar* m2, const short* grad_x, const short* grad_y,
+                       uchar* nmax_suppress, int cols, int depth, CannyNms mode, SimdPath simd)
+{
+  if (depth == CV_16U)
+    NmsRow((const ushort*)m0, (const ushort*)m1, (const ushort*)m2, grad_x, grad_y, (ushort*)nmax_suppress, cols, mode, simd);
+  else
+    NmsRow(m0, m1, m2, grad_x, grad_y, nmax_suppress, cols, mode, simd);
+}
@@ -0,0 +1,233 @@
+// Trace events of the MYCV_TRACE_* macros (Trace.hpp).
+//   Every thread appends to its own event list, so recording takes no
+//   lock: only the first event of a thread registers its list. The lists
+//   are kept when their thread ends and are read by the export functions
+//   once the traced work is done. A list is a ring of MaxThreadEvents, so
+//   a long stream keeps its latest events in bounded memory; the events
+//   it overwrote are counted and reported.
+//
+// By Steven Chen
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+struct TraceEvent {
+  const char* name;
+  int64 begin, end; // tick counts, a counter has begin == end
+  int64 value;      // items of a scope, value of a counter
+  bool counter;
+};
+
+// 256Ki events of 40 bytes: 10 MB per thread at most
+static const size_t MaxThreadEvents = 1 << 18;
+
+struct TraceThread {
+  int tid;
+  const char* name;
+  vector<TraceEvent> events; // a ring once full, oldest at next
+  size_t next;
+  int64 dropped;             // events overwritten since TraceClear
+
+  void Append(const TraceEvent& e)
+  {
+    if (events.size() < MaxThreadEvents) {
+      events.push_back(e);
+    } else {
+      events[next] = e;
+      next = (next + 1) % MaxThreadEvents;
+      dropped++;
+    }
+  }
+};
+
+static atomic<bool> trace_enabled(false);
+static mutex trace_mutex;
+static vector<TraceThread*> trace_threads; // never freed, events outlive their thread
+
+static TraceThread& ThisThread()
+{
+  static thread_local TraceThread* current = 0;
+  if (!current) {
+    current = new TraceThread;
+    current->name = 0;
+    current->next = 0;
+    current->dropped = 0;
+    current->events.reserve(4096);
+    lock_guard<mutex> lock(trace_mutex);
+    current->tid = (int)trace_threads.size() + 1;
+    trace_threads.push_back(current);
+  }
+  return *current;
+}
+
+void TraceEnable(bool enable)
+{
+  trace_enabled.store(enable, memory_order_relaxed);
+}
+
+bool TraceEnabled()
+{
+  return trace_enabled.load(memory_order_relaxed);
+}
+
+void TraceClear()
+{
+  lock_guard<mutex> lock(trace_mutex);
+  for (size_t t=0; t<trace_threads.size(); t++) {
+    trace_threads[t]->events.clear();
+    trace_threads[t]->next = 0;
+    trace_threads[t]->dropped = 0;
+  }
+}
+
+// Events overwritten in the rings of all threads, under trace_mutex
+static int64 DroppedEvents()
+{
+  int64 dropped = 0;
+  for (size_t t=0; t<trace_threads.size(); t++)
+    dropped += trace_threads[t]->dropped;
+  return dropped;
+}
+
+void TraceRecord(const char* name, int64 begin, int64 end, int64 items)
+{
+  TraceEvent e = { name, begin, end, items, false };
+  ThisThread().Append(e);
+}
+
+void TraceCount(const char* name, int64 value)
+{
+  int64 now = getTickCount();
+  TraceEvent e = { name, now, now, value, true };
+  ThisThread().Append(e);
+}
+
+void TraceThreadName(const char* name)
+{
+  ThisThread().name = name;
+}
+
+bool TraceWriteChrome(const string& path)
+{
+  ofstream out(path.c_str());
+  if (!out)
+    return false;
+  lock_guard<mutex> lock(trace_mutex);
+  int64 t0 = 0;
+  bool any = false;
+  for (size_t t=0; t<trace_threads.size(); t++)
+    for (size_t i=0; i<trace_threads[t]->events.size(); i++)
+      if (!any || trace_threads[t]->events[i].begin < t0) {
+        t0 = trace_threads[t]->events[i].begin;
+        any = true;
+      }
+
+  // ts and dur in microseconds from the first event
+  const double us = 1e6 / getTickFrequency();
+  const char* sep = "\n";
+  out << fixed << setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t t=0; t<trace_threads.size(); t++) {
+    const TraceThread& thread = *trace_threads[t];
+    if (thread.name) {
+      out << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.tid
+          << ",\"args\":{\"name\":\"" << thread.name << "\"}}";
+      sep = ",\n";
+    }
+    for (size_t i=0; i<thread.events.size(); i++) {
+      const TraceEvent& e = thread.events[i];
+      out << sep << "{\"name\":\"" << e.name << "\",\"ph\":\"" << (e.counter ? "C" : "X") << "\",\"ts\":" << (e.begin - t0) * us;
+      if (!e.counter)
+        out << ",\"dur\":" << (e.end - e.begin) * us;
+      out << ",\"pid\":1,\"tid\":" << thread.tid;
+      if (e.counter)
+        out << ",\"args\":{\"value\":" << e.value << "}";
+      else if (e.value)
+        out << ",\"args\":{\"items\":" << e.value << "}";
+      out << "}";
+      sep = ",\n";
+    }
+  }
+  out << "\n],\"otherData\":{\"dropped_events\":" << DroppedEvents() << "}}" << endl;
+  return (bool)out;
+}
+
+// Sums of one scope or counter name over all threads
+struct TraceStat {
+  string name;
+  long calls;
+  double total_ms, max_ms;
+  int64 items; // or the counter total
+  TraceStat() : calls(0), total_ms(0), max_ms(0), items(0) {}
+};
+
+static bool MoreTime(const TraceStat& a, const TraceStat& b)
+{
+  return a.total_ms > b.total_ms;
+}
+
+void TracePrintSummary(ostream& os, int64 since)
+{
+  vector<TraceStat> scopes, counters;
+  map<string, size_t> scope_index, counter_index;
+  const double ms = 1000. / getTickFrequency();
+  int64 dropped;
+  {
+    lock_guard<mutex> lock(trace_mutex);
+    dropped = DroppedEvents();
+    for (size_t t=0; t<trace_threads.size(); t++) {
+      const vector<TraceEvent>& events = trace_threads[t]->events;
+      for (size_t i=0; i<events.size(); i++) {
+        const TraceEvent& e = events[i];
+        if (e.begin < since)
+          continue;
+        vector<TraceStat>& stats = e.counter ? counters : scopes;
+        map<string, size_t>& index = e.counter ? counter_index : scope_index;
+        map<string, size_t>::iterator it = index.find(e.name);
+        if (it == index.end()) {
+          it = index.insert(make_pair(string(e.name), stats.size())).first;
+          stats.push_back(TraceStat());
+          stats.back().name = e.name;
+        }
+        TraceStat& s = stats[it->second];
+        double dur = (e.end - e.begin) * ms;
+        s.calls++;
+        s.total_ms += dur;
+        s.max_ms = max(s.max_ms, dur);
+        s.items += e.value;
+      }
+    }
+  }
+  sort(scopes.begin(), scopes.end(), MoreTime);
+
+  // scopes nest (a stage contains its kernels), so the times do not add up
+  os << left << setw(24) << "scope" << right << setw(8) << "calls" << setw(12) << "total ms" << setw(12) << "mean ms"
+     << setw(12) << "max ms" << setw(12) << "Mitems/s" << endl;
+  os << fixed << setprecision(3);
+  for (size_t i=0; i<scopes.size(); i++) {
+    const TraceStat& s = scopes[i];
+    os << left << setw(24) << s.name << right << setw(8) << s.calls << setw(12) << s.total_ms
+       << setw(12) << s.total_ms / s.calls << setw(12) << s.max_ms;
+    if (s.items > 0 && s.total_ms > 0)
+      os << setw(12) << setprecision(1) << s.items / (s.total_ms * 1000.) << setprecision(3);
+    os << endl;
+  }
+  if (dropped)
+    os << dropped << " older events were overwritten, a thread keeps its last " << MaxThreadEvents << endl;
+  if (counters.empty())
+    return;
+  os << left << setw(24) << "counter" << right << setw(8) << "calls" << setw(16) << "total" << endl;
+  for (size_t i=0; i<counters.size(); i++)
+    os << left << setw(24) << counters[i].name << right << setw(8) << counters[i].calls << setw(16) << counters[i].items << endl;
+}
@@ -1,95 +1,146 @@
 // Otsu's method for image thresholding, or,
-// the reduction of a graylevel image to a binary image. 
-// 
+// the reduction of a graylevel image to a binary image.
+//   The histogram is counted into 4 interleaved sub-histograms, so that
+//   runs of equal pixels do not wait on their own increments, and large
+//   images are split into row strips counted on cv::parallel_for_.
+//   The threshold is found in one sweep of cumulative sums.
+//
 // By Steven Chen
 //
 
+#include "otsu_threshold.hpp"
+#include "Trace.hpp"
+
 #include <iostream>
+#include <vector>
+#include <cfloat>
+#include <cstring>
 using namespace std;
 
 #include <opencv2/opencv.hpp>
 using namespace cv;
- 
-// src: input,  8-bits 1-channel gray image
-// dst: output, OTSU binary image, 8-bits 1-channel binary image
-// inv: output type, 0: P=(P>TH)?255:0;  1: P=(P>TH)?0:255;
-int otsu_threshold (const Mat& src, Mat& dst, int inv=0)
-{
-  int threshold = 0;
-  const int GrayScale = 256;
-  int historgram[GrayScale] = {0};
-  float LevelWeight[GrayScale] = {0};
 
-  int width = src.cols;
-  int height = src.rows;
-  long TotalPix = width * height; 
-  uchar* data = (uchar*)src.data;
+static const int GrayScale = 256;
+static const int MaxStrips = 16; // strip histograms live on the stack
 
-  // Count pixels at each gray level
-  for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      historgram[src.at<uchar>(i, j)]++;
+// Count rows [y0, y1) into hist (added to it)
+static void CountRows(const Mat& src, int y0, int y1, int* hist)
+{
+  int sub[4][GrayScale];
+  memset(sub, 0, sizeof(sub));
+  for (int y = y0; y < y1; y++) {
+    const uchar* p = src.ptr<uchar>(y);
+    int x = 0;
+    for (; x <= src.cols-4; x += 4) {
+      sub[0][p[x]]++;
+      sub[1][p[x+1]]++;
+      sub[2][p[x+2]]++;
+      sub[3][p[x+3]]++;
     }
+    for (; x < src.cols; x++)
+      sub[0][p[x]]++;
   }
+  for (int i = 0; i < GrayScale; i++)
+    hist[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+}
 
-  // calculate weight(or percentage) of gray levels to whole image
-  for (int i = 0; i < GrayScale; i++) {
-     LevelWeight[i] = (float)historgram[i] / TotalPix;
+class HistogramBody : public ParallelLoopBody
+{
+public:
+  HistogramBody(const Mat& src, int strip_height, int* strip_hist) :
+    src(src), strip_height(strip_height), strip_hist(strip_hist) {}
+  void operator()(const Range& range) const
+  {
+    for (int s = range.start; s < range.end; s++)
+      CountRows(src, s*strip_height, min((s+1)*strip_height, src.rows), &strip_hist[s*GrayScale]);
+  }
+private:
+  const Mat& src;
+  int strip_height;
+  int* strip_hist;
+};
+
+void otsu_histogram(const Mat& src, int hist[256])
+{
+  CV_Assert(src.type() == CV_8UC1);
+  memset(hist, 0, GrayScale*sizeof(int));
+  // about 64K pixels per strip, not more strips than threads
+  int nstrips = min(min((int)(src.total() >> 16), getNumThreads()), MaxStrips);
+  nstrips = max(1, min(nstrips, src.rows));
+  if (nstrips == 1) {
+    CountRows(src, 0, src.rows, hist);
+    return;
   }
+  int strip_height = (src.rows + nstrips - 1) / nstrips;
+  nstrips = (src.rows + strip_height - 1) / strip_height;
+  int strip_hist[MaxStrips*GrayScale];
+  memset(strip_hist, 0, nstrips*GrayScale*sizeof(int));
+  parallel_for_(Range(0, nstrips), HistogramBody(src, strip_height, strip_hist));
+  for (int s = 0; s < nstrips; s++)
+    for (int i = 0; i < GrayScale; i++)
+      hist[i] += strip_hist[s*GrayScale + i];
+}
 
-  // Iterate each gray level, and find a gray level as threshold make delta has maximum value
-  // Method description:
-  // image MxN
-  // N0: background pixels
-  // N1: foreground pixels
-  // w0: background pixels' percentage
-  // w1: foreground pixels' percentage
-  // u0: background pixels' average gray level
-  // u1: foreground pixels' average gray level
-  // u: whole image's average gray level
-  // deltaXXX: variances of the two classes
-  //
-  // w0 = N0/M×N                   (1)
-  // w1 = N1/M×N                   (2)
-  // N0+N1 = M×N                   (3)
-  // w0+w1 = 1                     (4)
-  // u = w0*u0+w1*u1               (5)
-  // delta = w0(u0-u)^2+w1(u1-u)^2 (6)
-  //       = w0w1(u0-u1)^2
-  float w0, w1, u0tmp, u1tmp, u0, u1, u, deltaTmp, deltaMax = 0;
-  for (int i = 0; i < GrayScale; i++) { //iterate each gray level [0:255]
-     w0 = w1 = u0tmp = u1tmp = u0 = u1 = u = deltaTmp = 0;
-     for (int j = 0; j < GrayScale; j++)
-     {
-        if (j <= i)   // background
-        {
-           w0 += LevelWeight[j];
-           u0tmp += j * LevelWeight[j];
-        }
-        else   // foreground
-        {
-           w1 += LevelWeight[j];
-           u1tmp += j * LevelWeight[j];
-        }
-     }
-     u0 = u0tmp / w0;
-     u1 = u1tmp / w1;
-     u = u0tmp + u1tmp;
-     deltaTmp = w0 * pow((u0 - u), 2) + w1 * pow((u1 - u), 2);
-     if (deltaTmp > deltaMax)
-     {
-        deltaMax = deltaTmp;
-        threshold = i;
-     }
+// Iterate each gray level, and find a gray level as threshold make delta has maximum value
+// Method description:
+// q1: background pixels' percentage (gray level <= i)
+// q2: foreground pixels' percentage
+// mu1, mu2: background/foreground pixels' average gray level
+// mu: whole image's average gray level
+// delta = q1(mu1-mu)^2 + q2(mu2-mu)^2 = q1*q2*(mu1-mu2)^2
+// q1 and mu1 are updated from level i-1 to i, mu2 = (mu - q1*mu1)/q2.
+int otsu_threshold_hist(const int hist[256])
+{
+  long total = 0;
+  double mu = 0;
+  for (int i = 0; i < GrayScale; i++) {
+    total += hist[i];
+    mu += i * (double)hist[i];
   }
+  if (total == 0)
+    return 0;
+  const double scale = 1. / total;
+  mu *= scale;
 
-  for (int i=0; i < src.rows; i++) {
-    for (int j=0; j < src.cols; j++) {
-      if (inv)
-        dst.at<uchar>(i, j) = (src.at<uchar>(i, j) > threshold) ? 0 : 255;
-      else
-        dst.at<uchar>(i, j) = (src.at<uchar>(i, j) > threshold) ? 255 : 0;
+  int threshold = 0;
+  double q1 = 0, mu1 = 0, delta_max = 0;
+  for (int i = 0; i < GrayScale; i++) {
+    double p_i = hist[i] * scale;
+    mu1 *= q1;
+    q1 += p_i;
+    double q2 = 1. - q1;
+    if (min(q1, q2) < FLT_EPSILON || max(q1, q2) > 1. - FLT_EPSILON)
+      continue;
+    mu1 = (mu1 + i*p_i) / q1;
+    double mu2 = (mu - q1*mu1) / q2;
+    double delta = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+    if (delta > delta_max) {
+      delta_max = delta;
+      threshold = i;
     }
   }
   return threshold;
 }
+
+// src: input,  8-bits 1-channel gray image
+// dst: output, OTSU binary image, 8-bits 1-channel binary image
+// inv: output type, 0: P=(P>TH)?255:0;  1: P=(P>TH)?0:255;
+int otsu_threshold (const Mat& src, Mat& dst, int inv)
+{
+  MYCV_TRACE_SCOPE("otsu", (int64)src.total());
+  int hist[GrayScale];
+  otsu_histogram(src, hist);
+  int threshold = otsu_threshold_hist(hist);
+
+  uchar lut[GrayScale];
+  for (int i = 0; i < GrayScale; i++)
+    lut[i] = ((i > threshold) != (inv != 0)) ? 255 : 0;
+  dst.create(src.size(), CV_8UC1);
+  for (int y = 0; y < src.rows; y++) {
+    const uchar* s = src.ptr<uchar>(y);
+    uchar* d = dst.ptr<uchar>(y);
+    for (int x = 0; x < src.cols; x++)
+      d[x] = lut[s[x]];
+  }
+  return threshold;
+}
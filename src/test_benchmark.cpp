@@ -0,0 +1,305 @@
+// Stage benchmarks ---
+// Time every stage of the pipeline against its OpenCV counterpart, on
+// synthetic frames from VGA to 8K, in one binary (no define.hpp switch
+// and no rebuild needed to compare).
+//  * Like Google Benchmark, each benchmark runs a warm-up call, then
+//    repeats the call until it has run for min_time seconds and reports
+//    the time per call. Every repetition is reported, with the mean,
+//    median and stddev when there are several.
+//  * The JSON output follows Google Benchmark's schema ("context" and
+//    "benchmarks", real_time/cpu_time/time_unit/items_per_second), so
+//    its compare tools can diff two runs. Items are pixels.
+//  * Both sides reuse their outputs and scratch buffers between calls,
+//    and OpenCV runs on -t threads (1 by default, as the stages here are
+//    serial).
+// By Steven Chen
+
+#include "MyFilter.hpp"
+#include "MyCanny.hpp"
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+#include "otsu_threshold.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |     | print this message    }"
+  "{f filter       |     | run only the benchmarks whose name contains this text}"
+  "{s sizes        | VGA,HD,FHD,4K,8K | frame sizes}"
+  "{m min_time     | 0.5 | seconds each measurement runs at least}"
+  "{r repetitions  | 1   | measurements per benchmark}"
+  "{t threads      | 1   | OpenCV threads, 0 = OpenCV default}"
+  "{o out          |     | write the JSON report to this file}"
+  "{j json         |     | print the JSON report instead of the table}"
+  ;
+
+struct BenchSize {
+  const char* name;
+  int cols, rows;
+};
+static const BenchSize bench_sizes[] = {
+  { "VGA", 640, 480 }, { "HD", 1280, 720 }, { "FHD", 1920, 1080 }, { "4K", 3840, 2160 }, { "8K", 7680, 4320 }
+};
+
+// Synthetic frames of one size: blurred noise, so that filters, edges
+// and components see structure at several scales
+struct BenchImages {
+  Mat bgr, gray, binary;
+  BenchImages(int cols, int rows)
+  {
+    bgr.create(rows, cols, CV_8UC3);
+    RNG rnd_num(12345);
+    rnd_num.fill(bgr, RNG::UNIFORM, 0, 256);
+    blur(bgr, bgr, Size(5, 5));
+    cvtColor(bgr, gray, COLOR_BGR2GRAY);
+    threshold(gray, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+  }
+};
+
+// One benchmark: name "<stage>/<mycv|opencv>/<size>" and the call to time
+struct Benchmark {
+  string name;
+  function<void()> run;
+};
+
+struct BenchRun {
+  string name, run_name, run_type, aggregate;
+  long iterations;
+  double real_ms, cpu_ms, pixels_per_second;
+  string label;
+};
+
+// Run fn until min_time has passed, growing the iteration count like
+// Google Benchmark does; times are per call
+static void Measure(const function<void()>& fn, double min_time, long& iterations, double& real_ms, double& cpu_ms)
+{
+  for (long n = 1; ; ) {
+    int64 t0 = getTickCount();
+    clock_t c0 = clock();
+    for (long i=0; i<n; i++)
+      fn();
+    double real = (getTickCount() - t0) / getTickFrequency();
+    double cpu = double(clock() - c0) / CLOCKS_PER_SEC;
+    if (real >= min_time || n >= 1000000000L) {
+      iterations = n;
+      real_ms = real * 1000. / n;
+      cpu_ms = cpu * 1000. / n;
+      return;
+    }
+    // aim 40% past min_time, at most 10 times more iterations per round
+    double grow = real > 0 ? min(10., min_time * 1.4 / real) : 10.;
+    n = max(n + 1, (long)(n * grow));
+  }
+}
+
+static string JsonString(const string& s)
+{
+  string out = "\"";
+  for (size_t i=0; i<s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\')
+      out += '\\';
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+static void WriteJson(ostream& os, const vector<BenchRun>& runs, const string& executable, int threads)
+{
+  char date[64], host[256] = "";
+  time_t now = time(0);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+  gethostname(host, sizeof(host)-1);
+  static const char* const simd_names[] = { "auto", "none", "sse2", "avx2" };
+
+  os << "{" << endl;
+  os << "  \"context\": {" << endl;
+  os << "    \"date\": " << JsonString(date) << "," << endl;
+  os << "    \"host_name\": " << JsonString(host) << "," << endl;
+  os << "    \"executable\": " << JsonString(executable) << "," << endl;
+  os << "    \"num_cpus\": " << getNumberOfCPUs() << "," << endl;
+  os << "    \"opencv_version\": " << JsonString(CV_VERSION) << "," << endl;
+  os << "    \"opencv_threads\": " << threads << "," << endl;
+  os << "    \"simd\": " << JsonString(simd_names[ResolveSimdPath(SIMD_AUTO)]) << "," << endl;
+#ifdef NDEBUG
+  os << "    \"library_build_type\": \"release\"" << endl;
+#else
+  os << "    \"library_build_type\": \"debug\"" << endl;
+#endif
+  os << "  }," << endl;
+  os << "  \"benchmarks\": [" << endl;
+  os << setprecision(10);
+  for (size_t i=0; i<runs.size(); i++) {
+    const BenchRun& r = runs[i];
+    os << "    {" << endl;
+    os << "      \"name\": " << JsonString(r.name) << "," << endl;
+    os << "      \"run_name\": " << JsonString(r.run_name) << "," << endl;
+    os << "      \"run_type\": " << JsonString(r.run_type) << "," << endl;
+    if (!r.aggregate.empty())
+      os << "      \"aggregate_name\": " << JsonString(r.aggregate) << "," << endl;
+    os << "      \"iterations\": " << r.iterations << "," << endl;
+    os << "      \"real_time\": " << r.real_ms << "," << endl;
+    os << "      \"cpu_time\": " << r.cpu_ms << "," << endl;
+    os << "      \"time_unit\": \"ms\"," << endl;
+    os << "      \"items_per_second\": " << r.pixels_per_second << "," << endl;
+    os << "      \"label\": " << JsonString(r.label) << endl;
+    os << "    }" << (i+1 < runs.size() ? "," : "") << endl;
+  }
+  os << "  ]" << endl;
+  os << "}" << endl;
+}
+
+// mean, median and stddev of the repetitions of one benchmark
+static void AddAggregates(vector<BenchRun>& runs, size_t first)
+{
+  size_t n = runs.size() - first;
+  if (n < 2)
+    return;
+  vector<double> real, cpu;
+  for (size_t i=first; i<runs.size(); i++) {
+    real.push_back(runs[i].real_ms);
+    cpu.push_back(runs[i].cpu_ms);
+  }
+  double real_mean = 0, cpu_mean = 0;
+  for (size_t i=0; i<n; i++) {
+    real_mean += real[i] / n;
+    cpu_mean += cpu[i] / n;
+  }
+  double real_var = 0, cpu_var = 0;
+  for (size_t i=0; i<n; i++) {
+    real_var += (real[i] - real_mean) * (real[i] - real_mean) / (n - 1);
+    cpu_var += (cpu[i] - cpu_mean) * (cpu[i] - cpu_mean) / (n - 1);
+  }
+  sort(real.begin(), real.end());
+  sort(cpu.begin(), cpu.end());
+  double real_median = n % 2 ? real[n/2] : (real[n/2-1] + real[n/2]) / 2;
+  double cpu_median = n % 2 ? cpu[n/2] : (cpu[n/2-1] + cpu[n/2]) / 2;
+
+  const BenchRun base = runs[first];
+  double pixels = base.pixels_per_second * base.real_ms / 1000.;
+  const char* names[3] = { "mean", "median", "stddev" };
+  double reals[3] = { real_mean, real_median, sqrt(real_var) };
+  double cpus[3] = { cpu_mean, cpu_median, sqrt(cpu_var) };
+  for (int a=0; a<3; a++) {
+    BenchRun r = base;
+    r.name = base.run_name + "_" + names[a];
+    r.run_type = "aggregate";
+    r.aggregate = names[a];
+    r.iterations = (long)n;
+    r.real_ms = reals[a];
+    r.cpu_ms = cpus[a];
+    r.pixels_per_second = (a < 2 && reals[a] > 0) ? pixels * 1000. / reals[a] : 0;
+    runs.push_back(r);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("Benchmark of every stage against OpenCV, JSON output in Google Benchmark's format.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+  string filter = parser.has("f") ? parser.get<String>("f") : String();
+  string size_list = "," + parser.get<String>("s") + ",";
+  double min_time = max(0., parser.get<double>("m"));
+  int repetitions = max(1, parser.get<int>("r"));
+  int threads = parser.get<int>("t");
+  string out_file = parser.get<String>("o");
+  bool json = parser.has("j");
+  if (threads > 0)
+    setNumThreads(threads);
+  threads = getNumThreads();
+
+  vector<BenchRun> runs;
+  if (!json) {
+    cout << left << setw(34) << "Benchmark" << right << setw(12) << "Time ms" << setw(12) << "CPU ms"
+         << setw(12) << "Iterations" << setw(12) << "Mpixel/s" << endl;
+    cout << string(82, '-') << endl;
+  }
+  for (size_t s=0; s<sizeof(bench_sizes)/sizeof(bench_sizes[0]); s++) {
+    const BenchSize& size = bench_sizes[s];
+    if (size_list.find(string(",") + size.name + ",") == string::npos)
+      continue;
+    BenchImages img(size.cols, size.rows);
+
+    // outputs and scratch kept across calls, on both sides
+    Mat dst, gx, gy, labels;
+    FilterBuf filter_buf;
+    CannyBuf canny_buf;
+    LabelBuf label_buf;
+    CannyOptions canny_opts;
+    vector<Benchmark> benchmarks;
+    Benchmark b;
+    #define BENCH(stage, impl, call) b.name = string(stage "/" impl "/") + size.name; b.run = [&] { call; }; benchmarks.push_back(b)
+    BENCH("ColorToGray", "mycv", MyColorToGray(img.bgr, dst));
+    BENCH("ColorToGray", "opencv", cvtColor(img.bgr, dst, COLOR_BGR2GRAY));
+    BENCH("MedianFilter3x3", "mycv", MedianFilter(img.gray, dst, 1, filter_buf));
+    BENCH("MedianFilter3x3", "opencv", medianBlur(img.gray, dst, 3));
+    BENCH("MedianFilter5x5", "mycv", MedianFilter(img.gray, dst, 2, filter_buf));
+    BENCH("MedianFilter5x5", "opencv", medianBlur(img.gray, dst, 5));
+    BENCH("BoxFilter3x3", "mycv", BoxFilter(img.gray, dst, 1, false, filter_buf));
+    BENCH("BoxFilter3x3", "opencv", blur(img.gray, dst, Size(3, 3)));
+    BENCH("BoxFilter5x5", "mycv", BoxFilter(img.gray, dst, 2, false, filter_buf));
+    BENCH("BoxFilter5x5", "opencv", blur(img.gray, dst, Size(5, 5)));
+    BENCH("Sobel", "mycv", MySobel(img.gray, gx, gy));
+    BENCH("Sobel", "opencv", Sobel(img.gray, gx, CV_16S, 1, 0, 3); Sobel(img.gray, gy, CV_16S, 0, 1, 3));
+    BENCH("Canny", "mycv", MyCanny(img.gray, dst, 30, 90, canny_opts, canny_buf));
+    BENCH("Canny", "opencv", Canny(img.gray, dst, 30, 90, 3, true));
+    BENCH("LabelConnected", "mycv", LabelConnected(img.binary, labels, label_buf));
+    BENCH("LabelConnected", "opencv", connectedComponents(img.binary, labels, 8, CV_32S));
+    BENCH("Otsu", "mycv", otsu_threshold(img.gray, dst));
+    BENCH("Otsu", "opencv", threshold(img.gray, dst, 0, 255, THRESH_BINARY | THRESH_OTSU));
+    #undef BENCH
+
+    for (size_t i=0; i<benchmarks.size(); i++) {
+      const Benchmark& bench = benchmarks[i];
+      if (!filter.empty() && bench.name.find(filter) == string::npos)
+        continue;
+      bench.run(); // warm-up: sizes the outputs and the scratch
+      size_t first = runs.size();
+      for (int rep=0; rep<repetitions; rep++) {
+        BenchRun r;
+        r.name = r.run_name = bench.name;
+        r.run_type = "iteration";
+        Measure(bench.run, min_time, r.iterations, r.real_ms, r.cpu_ms);
+        r.pixels_per_second = r.real_ms > 0 ? (double)img.gray.total() * 1000. / r.real_ms : 0;
+        ostringstream label;
+        label << size.cols << "x" << size.rows;
+        r.label = label.str();
+        runs.push_back(r);
+      }
+      AddAggregates(runs, first);
+      if (!json)
+        for (size_t k=first; k<runs.size(); k++)
+          cout << left << setw(34) << runs[k].name << right << fixed << setprecision(3) << setw(12) << runs[k].real_ms
+               << setw(12) << runs[k].cpu_ms << setw(12) << runs[k].iterations << setprecision(1) << setw(12)
+               << runs[k].pixels_per_second / 1e6 << endl;
+    }
+  }
+
+  if (json)
+    WriteJson(cout, runs, argv[0], threads);
+  if (!out_file.empty()) {
+    ofstream out(out_file.c_str());
+    if (!out) {
+      cout << "Fail to write: " << out_file << endl;
+      return -1;
+    }
+    WriteJson(out, runs, argv[0], threads);
+  }
+  return 0;
+}
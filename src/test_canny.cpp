@@ -7,6 +7,7 @@
 */
 
 #include "define.hpp"
+#include "CannyContext.hpp"
 
 #include <iostream>
 using namespace std;
@@ -19,21 +20,16 @@ bool DEBUG_SHOW = false;
 const string hi_tkbar_name = "High Threshold:";
 const string lo_tkbar_name = "Low Threshold:";
 
-void MyColorToGray(const Mat& src, Mat& img); // Gray = R*0.299 + G*0.587 + B*0.114
-void MedianFilter(const Mat& src, Mat& dst);
-void BoxFilter(const Mat& src, Mat& dst);
-void MyCanny(const Mat& src, Mat& detected_edges, int lo_threshold, int hi_threshold, bool L2gradient=true, bool debug=false);
-int  LabelConnected(const Mat& img, Mat& label, uint connectivity=8);
-int  otsu_threshold (const Mat& src, Mat& dst, int typ=0);
-
 // createTrackbar's UserData Structure
 struct tkbar_udata_struct {
   string window_name;
   Mat img;
-  bool L2gradient; // For Canny L2gradient precision: true | false
-  uint connectivity; // for neighbering connectivity, 4 or 8 only
-  tkbar_udata_struct(string winname, Mat im, bool gradient, uint conn) :
-    window_name(winname), img(im), L2gradient(gradient), connectivity(conn) {}
+  CannyContext* ctx; // pipeline of the image, only the edges are redone
+  Mat masked, output; // display, reused by every callback
+  vector<Vec3b> color_lut;
+  RNG rnd_num;
+  tkbar_udata_struct(string winname, Mat im, CannyContext* context) :
+    window_name(winname), img(im), ctx(context), rnd_num(cvGetTickCount()) {}
 };
 
 
@@ -48,92 +44,115 @@ int icolor = (unsigned) rnd_num;
 return Scalar( icolor&255, (icolor>>8)&255, (icolor>>16)&255 );
 }
 
+// Colour all objects in one pass through a table of random colours,
+// object 0 is left black. labels: CV_16UC1 or CV_32SC1
+template<typename T> static void colorLabelRows(const Mat& labels, const vector<Vec3b>& lut, Mat& output)
+{
+  for (int y=0; y<labels.rows; y++) {
+    const T* lab = labels.ptr<T>(y);
+    Vec3b* out = output.ptr<Vec3b>(y);
+    for (int x=0; x<labels.cols; x++)
+      out[x] = lut[lab[x]];
+  }
+}
+
+static void colorLabels(const Mat& labels, int num_objects, RNG& rnd_num, vector<Vec3b>& lut, Mat& output)
+{
+  lut.assign(max(num_objects, 1), Vec3b(0, 0, 0));
+  for (int i=1; i<num_objects; i++) {
+    Scalar color = randomColor(rnd_num);
+    lut[i] = Vec3b((uchar)color[0], (uchar)color[1], (uchar)color[2]);
+  }
+  output.create(labels.size(), CV_8UC3);
+  if (labels.depth() == CV_16U)
+    colorLabelRows<ushort>(labels, lut, output);
+  else
+    colorLabelRows<int>(labels, lut, output);
+}
+
+// The largest object besides object 0 (mostly the background)
+static void printLargestObject(const Mat& stats, const Mat& centroids)
+{
+  int largest = 0;
+  for (int i=1; i<stats.rows; i++)
+    if (largest == 0 || stats.at<int>(i, CC_STAT_AREA) > stats.at<int>(largest, CC_STAT_AREA))
+      largest = i;
+  if (largest == 0)
+    return;
+  cout << "largest object " << largest << ": area= " << stats.at<int>(largest, CC_STAT_AREA)
+       << ", bbox= (" << stats.at<int>(largest, CC_STAT_LEFT) << "," << stats.at<int>(largest, CC_STAT_TOP) << ") "
+       << stats.at<int>(largest, CC_STAT_WIDTH) << "x" << stats.at<int>(largest, CC_STAT_HEIGHT)
+       << ", centroid= (" << centroids.at<double>(largest, 0) << "," << centroids.at<double>(largest, 1) << ")";
+  if (stats.cols > LABEL_STAT_PERIMETER)
+    cout << ", perimeter= " << stats.at<int>(largest, LABEL_STAT_PERIMETER);
+  cout << endl;
+}
+
+// Backends the stages ran with, and the times of the tuned ones
+static void printBackends(const CannyContext& ctx)
+{
+  cout << "backends: " << BackendsString(ctx.selected) << endl;
+  for (int s=0; s<PIPE_STAGES; s++) {
+    if (!BackendIsAuto(ctx.backends[s]))
+      continue;
+    cout << "  " << PipeStageName((PipeStage)s) << " tuned:";
+    for (int b=BACKEND_AUTO+1; b<BACKEND_COUNT; b++)
+      if (ctx.tune_ms[s][b] > 0)
+        cout << " " << BackendName((Backend)b) << "=" << ctx.tune_ms[s][b] << "ms";
+    cout << endl;
+  }
+}
+
 /*
  * @function Adj_CannyThreshold
  * @brief Trackbar callback - Canny thresholds input
  */
 void Adj_CannyThreshold(int lo_bar_val, int hi_bar_val, void* userdata)
 {
-  tkbar_udata_struct tkbar_udata = *(tkbar_udata_struct*) userdata;
+  tkbar_udata_struct& tkbar_udata = *(tkbar_udata_struct*) userdata;
 
   string& window_name = tkbar_udata.window_name;
   Mat& src = tkbar_udata.img;
-  uint connectivity = tkbar_udata.connectivity;
-  bool L2gradient = tkbar_udata.L2gradient;
-
-  // Convert the image to grayscale
-  Mat src_gray(src.size(), CV_8UC1);
-  MyColorToGray(src, src_gray);
-  dbg_imshow("2: Convert to Gray", src_gray);
-
-  /// Reduce noise with a kernel 3x3
-  #ifdef OCV_BLUR
-    blur(src_gray, src_gray, Size(3,3));
-    dbg_imshow("3: Apply OCV blur", src_gray);
-  #else
-    MedianFilter(src_gray, src_gray); // remove noise
-    dbg_imshow("3.1: Apply MedianFilter", src_gray);
-
-    BoxFilter(src_gray, src_gray); // average
-    dbg_imshow("3.2: Apply BoxFilter", src_gray);
-  #endif
-
-  // Canny edge detector
-  Mat detected_edges = Mat::zeros(src_gray.size(), src_gray.type()); // all 0s for set all boundary are not edge
-  #ifdef OCV_CANNY
-    const int kernel_size = 3;
-    Canny(src_gray, detected_edges, lo_bar_val, hi_bar_val, kernel_size, L2gradient);
-  #else
-    MyCanny(src_gray, detected_edges, lo_bar_val, hi_bar_val, L2gradient, DEBUG_SHOW);
-  #endif
-  dbg_imshow("4: Edge detection with Canny", detected_edges);
+  CannyContext& ctx = *tkbar_udata.ctx;
+  int64 start = getTickCount();
 
-  // Using Canny's output as a mask, and display result
-  Mat dst(src.size(), src.type(), Scalar::all(0));
-  src.copyTo(dst, detected_edges);
-  imshow(window_name, dst);
-
-  // find connected components
-  Mat labels(src_gray.size(), CV_16UC1, Scalar(0));
-  #ifdef OCV_LABCONN
-    int num_objects= connectedComponents(detected_edges, labels, connectivity, CV_16U);
-  #else
-    int num_objects = LabelConnected(detected_edges, labels, connectivity);
-  #endif
-  cout << "num_objects = " << num_objects << endl;
+  // Canny edge detector and the edges' connected components
+  ctx.Detect(lo_bar_val, hi_bar_val);
+  if (ctx.selected[PIPE_CANNY] != BACKEND_OPENCV)
+    dbg_imshow("MyCanny 2: Non-Maximum Suppression", ctx.nms);
+  dbg_imshow("4: Edge detection with Canny", ctx.edges);
 
-  RNG rnd_num( cvGetTickCount() ); // Random seed
-  // Create output image coloring the objects
-  Mat output= Mat::zeros(src.rows, src.cols, CV_8UC3);
-  for(int i=1; i<num_objects; i++){
-    Mat mask= labels==i;
-    output.setTo(randomColor(rnd_num), mask);
-    // imshow("mask"+to_string(i), output); // Steven
-    // cout<<"Size of object["<<i<<"]="<<countNonZero(mask)<<endl;
+  // Using Canny's output as a mask, and display result
+  {
+    MYCV_TRACE_SCOPE("mask", (int64)src.total());
+    tkbar_udata.masked.create(src.size(), src.type());
+    tkbar_udata.masked.setTo(Scalar::all(0));
+    src.copyTo(tkbar_udata.masked, ctx.edges);
   }
-  imshow("5: Find Edge Connected Components", output);
+  imshow(window_name, tkbar_udata.masked);
 
-  // find connected components with gray threshold image
-  Mat src_bin(src_gray.size(), CV_8UC1, Scalar(0));
-  otsu_threshold(src_gray, src_bin);
-  imshow("6.1: OTSU Binary Image", src_bin);
-  num_objects = LabelConnected(src_bin, labels, connectivity);
+  cout << "num_objects = " << ctx.num_edge_objects << endl;
+  if (!ctx.edge_stats.empty())
+    printLargestObject(ctx.edge_stats, ctx.edge_centroids);
+  cout << "scratch allocations = " << ctx.Allocations() << endl;
 
   // Create output image coloring the objects
-  output= Mat::zeros(src.rows, src.cols, CV_8UC3);
-  for(int i=1; i<num_objects; i++){
-    Mat mask= labels==i;
-    output.setTo(randomColor(rnd_num), mask);
+  {
+    MYCV_TRACE_SCOPE("colour labels", (int64)ctx.edge_labels.total());
+    colorLabels(ctx.edge_labels, ctx.num_edge_objects, tkbar_udata.rnd_num, tkbar_udata.color_lut, tkbar_udata.output);
   }
-  imshow("6.2: Find Binary Connected Components", output);
+  imshow("5: Find Edge Connected Components", tkbar_udata.output);
 
+  // where the time of this change went
+  if (TraceEnabled())
+    TracePrintSummary(cout, start);
 }
 
 
 // Low threshold track bar
 void LoTkBar_Change(int pos, void* userdata)
 {
-  tkbar_udata_struct tkbar_udata = *(tkbar_udata_struct*) userdata;
+  tkbar_udata_struct& tkbar_udata = *(tkbar_udata_struct*) userdata;
   int loThreshold = pos;
   int hiThreshold = getTrackbarPos (hi_tkbar_name, tkbar_udata.window_name);
   if (loThreshold > hiThreshold) {
@@ -148,7 +167,7 @@ void LoTkBar_Change(int pos, void* userdata)
 // High threshold track bar
 void HiTkBar_Change(int pos, void* userdata)
 {
-  tkbar_udata_struct tkbar_udata = *(tkbar_udata_struct*) userdata;
+  tkbar_udata_struct& tkbar_udata = *(tkbar_udata_struct*) userdata;
   int hiThreshold = pos;
   if (hiThreshold == 0) {
     hiThreshold = 1;
@@ -171,15 +190,28 @@ const String cmd_help =
   "{c connectivity | 8 | connectivity=4 or 8 only}"
   "{l l2gradient   |   | L2gradient=true or false}"
   "{d debug show   |   | show some images for debug}"
+  "{j threads      | 1 | MyCanny threads, >1 runs it tiled, 0 = all cores}"
+  "{b band         | 0 | MyCanny band height for tiled mode, 0 = auto}"
+  "{f fused        |   | MyCanny streams rows through 3-row buffers}"
+  "{s single       |   | MyCanny single-pass hysteresis instead of edge tracking}"
+  "{m mag16        |   | MyCanny keeps the gradient magnitude in 16 bits (no clipping at 255)}"
+  "{q quantized    |   | MyCanny NMS with 4 quantized directions instead of interpolation}"
+  "{k median_radius| 1 | MedianFilter radius, 1 = 3x3}"
+  "{r box_radius   | 0 | BoxFilter radius, 0 = 3x3 average of the 8 neighbours}"
+  "{t label_threads| 1 | LabelConnected threads, >1 labels strips in parallel, 0 = all cores}"
+  "{e edge_runs    |   | label the edges by runs of edge pixels, the background is not labeled}"
+  "{p presort      |   | sort the NMS pixels by magnitude once, thresholds only visit the pixels above low}"
+  "{T trace        |   | time every stage (build with -DMYCV_TRACE), print a table per change and write Chrome trace events to this file}"
+  "{B backends     |   | stage=backend,... stages gray denoise sobel canny label threshold all, backends auto scalar simd threaded opencv auto+opencv, @file reads them}"
   ;
 
 /** @function main */
 int main( int argc, char** argv )
 {
   // Parse command line 
-  if (argc < 2 || argc > 4) {
+  if (argc < 2) {
     cout << "Using Trackbar to adjust threshold for testing Canny algorithm & labeling connected components:" << endl;
-    cout << argv[0] << " <image_file> [-c=4|8] [-l=0: [-d: for show debug image]" << endl;
+    cout << argv[0] << " <image_file> [-c=4|8] [-l=0: [-d: for show debug image] [-j=threads] [-b=band height] [-f] [-s] [-m] [-q] [-k=median radius] [-r=box radius] [-t=label threads] [-e] [-p] [-B=stage=backend,...] [-T=trace.json]" << endl;
     cout << "More information ... -[h help usage ?]" << endl;
     return -1;
   }
@@ -195,8 +227,59 @@ int main( int argc, char** argv )
   String filename = parser.get<String>(0);
   uint connectivity = parser.get<int>("c");
   cout << "connectivity= " << connectivity << endl;
-  bool L2gradient = parser.has("l");
-  cout << "L2gradient= " << L2gradient << endl;
+  CannyOptions canny_opts;
+  canny_opts.L2gradient = parser.has("l");
+  cout << "L2gradient= " << canny_opts.L2gradient << endl;
+  int threads = parser.get<int>("j");
+  if (threads != 1) {
+    canny_opts.exec = CANNY_EXEC_TILED;
+    canny_opts.num_threads = threads;
+    canny_opts.band_height = parser.get<int>("b");
+    cout << "MyCanny tiled, threads= " << threads << ", band height= " << canny_opts.band_height << endl;
+  }
+  canny_opts.fused = parser.has("f");
+  cout << "MyCanny fused= " << canny_opts.fused << endl;
+  if (parser.has("s"))
+    canny_opts.hysteresis = CANNY_HYST_SINGLE_PASS;
+  cout << "MyCanny edge tracking= " << (canny_opts.hysteresis == CANNY_HYST_TRACE) << endl;
+  if (parser.has("m"))
+    canny_opts.mag_depth = CV_16U;
+  cout << "MyCanny 16-bit magnitude= " << (canny_opts.mag_depth == CV_16U) << endl;
+  if (parser.has("q"))
+    canny_opts.nms = CANNY_NMS_QUANTIZED;
+  cout << "MyCanny quantized NMS= " << (canny_opts.nms == CANNY_NMS_QUANTIZED) << endl;
+  int median_radius = parser.get<int>("k");
+  cout << "MedianFilter radius= " << median_radius << endl;
+  int box_radius = parser.get<int>("r");
+  cout << "BoxFilter radius= " << box_radius << endl;
+  int label_threads = parser.get<int>("t");
+  cout << "LabelConnected threads= " << label_threads << endl;
+  bool edge_runs = parser.has("e");
+  cout << "LabelRuns for edges= " << edge_runs << endl;
+  bool sorted_candidates = parser.has("p");
+  cout << "sorted NMS candidates= " << sorted_candidates << endl;
+  // -j and -t pick the threaded backends, -B overrides them
+  Backend backends[PIPE_STAGES];
+  DefaultBackends(backends);
+  if (threads != 1)
+    backends[PIPE_CANNY] = BACKEND_THREADED;
+  if (label_threads != 1)
+    backends[PIPE_LABEL] = BACKEND_THREADED;
+  string error;
+  if (parser.has("B") && !ParseBackends(parser.get<String>("B"), backends, error)) {
+    cout << "Bad backends: " << error << endl;
+    return -1;
+  }
+  cout << "backends= " << BackendsString(backends) << endl;
+  String trace_file = parser.has("T") ? parser.get<String>("T") : String();
+#ifdef MYCV_TRACE
+  TraceEnable(!trace_file.empty());
+#else
+  if (!trace_file.empty()) {
+    cout << "built without MYCV_TRACE, -T records nothing" << endl;
+    trace_file.clear();
+  }
+#endif
   DEBUG_SHOW = parser.has("debug");
   cout << "DEBUG_SHOW= " << DEBUG_SHOW << endl;
   if (!DEBUG_SHOW) cout << "add option [-d] to show debug image" << endl;
@@ -211,11 +294,39 @@ int main( int argc, char** argv )
   }
   imshow( "1: Source Image", src);
 
+  CannyContext ctx;
+  ctx.canny_opts = canny_opts;
+  ctx.connectivity = connectivity;
+  ctx.median_radius = median_radius;
+  ctx.box_radius = box_radius;
+  for (int s=0; s<PIPE_STAGES; s++)
+    ctx.backends[s] = backends[s];
+  ctx.label_threads = label_threads != 1 ? label_threads : 0;
+  ctx.edge_runs = edge_runs;
+  ctx.sorted_candidates = sorted_candidates;
+
+  // Gray, smoothing and the Otsu binary image do not depend on the thresholds
+  int64 start = getTickCount();
+  ctx.SetImage(src);
+  if (TraceEnabled())
+    TracePrintSummary(cout, start);
+  dbg_imshow("2: Convert to Gray", ctx.gray);
+  dbg_imshow("3: Apply MedianFilter and BoxFilter", ctx.smoothed);
+
+  // find connected components with gray threshold image
+  imshow("6.1: OTSU Binary Image", ctx.binary);
+  RNG rnd_num( cvGetTickCount() ); // Random seed
+  vector<Vec3b> color_lut;
+  Mat bin_output;
+  colorLabels(ctx.binary_labels, ctx.num_binary_objects, rnd_num, color_lut, bin_output);
+  imshow("6.2: Find Binary Connected Components", bin_output);
+
   int loThreshold = 30;
   int hiThreshold = 90;
-  int const max_Threshold = 255;
+  // a 16-bit magnitude goes up to 1020 (L1) or 1442 (L2)
+  int const max_Threshold = canny_opts.mag_depth == CV_16U ? 1442 : 255;
   // initial trackbar udata
-  tkbar_udata_struct tkbar_udata("Canny_detected_edges", src, L2gradient, connectivity);
+  tkbar_udata_struct tkbar_udata("Canny_detected_edges", src, &ctx);
 
   // Create a image window
   namedWindow(tkbar_udata.window_name, CV_WINDOW_AUTOSIZE);
@@ -226,10 +337,15 @@ int main( int argc, char** argv )
 
   // Initial callback function
   Adj_CannyThreshold(loThreshold, hiThreshold, &tkbar_udata);
+  printBackends(ctx);
 
   // Wait until user exit program by pressing a key
   cout << "Press any key to continue ..." << endl;
   waitKey(0);
   destroyAllWindows();
+  if (!trace_file.empty() && !TraceWriteChrome(trace_file)) {
+    cout << "Fail to write: " << trace_file << endl;
+    return -1;
+  }
   return 0;
 }
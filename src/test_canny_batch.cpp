@@ -0,0 +1,472 @@
+/*
+  Topic: Canny Edge Detection over many images, headless
+    test_canny's pipeline with fixed thresholds for servers without a
+    display: no window is opened and HighGUI is never called (libmycanny
+    is built with MYCV_NO_HIGHGUI).
+
+ * Inputs are image files, globs (patterns with * or ?), directories or .txt/.lst
+   lists with one path per line.
+ * Three stages overlap on a fixed pool of images handed over through
+   bounded queues: decode threads (imread), compute threads with one
+   CannyContext each, and encode threads that write
+     <out>/<name>_edges.png    edge map
+     <out>/<name>_labels.png   16-bit labels (<name>_labels.yml.gz when
+                               there are more than 65535 objects)
+     <out>/<name>_stats.csv    area, box, perimeter and centroid per object
+   and <out>/summary.csv with one line per input. An image that cannot be
+   read or processed gets its error there, the others go on.
+
+  Author: Steven Chen
+*/
+
+#include "define.hpp"
+#include "CannyContext.hpp"
+#include "WorkQueue.hpp"
+#include "Trace.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <sys/stat.h>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |    | print this message    }"
+  "{@inputs        |    | image files, globs, directories or .txt/.lst file lists}"
+  "{o out          |    | output directory, created if missing}"
+  "{lo low         | 30 | low hysteresis threshold }"
+  "{hi high        | 90 | high hysteresis threshold}"
+  "{w workers      | 0  | compute threads, 0 = all cores}"
+  "{io io_threads  | 2  | decode threads, and as many encode threads}"
+  "{n queue        | 0  | images in flight, 0 = 2 per thread}"
+  "{c connectivity | 8  | connectivity=4 or 8 only}"
+  "{l l2gradient   |    | L2gradient=true or false}"
+  "{f fused        |    | MyCanny streams rows through 3-row buffers}"
+  "{s single       |    | MyCanny single-pass hysteresis instead of edge tracking}"
+  "{m mag16        |    | MyCanny keeps the gradient magnitude in 16 bits (no clipping at 255)}"
+  "{q quantized    |    | MyCanny NMS with 4 quantized directions instead of interpolation}"
+  "{k median_radius| 1  | MedianFilter radius, 1 = 3x3}"
+  "{r box_radius   | 0  | BoxFilter radius, 0 = 3x3 average of the 8 neighbours}"
+  "{e edge_runs    |    | label the edges by runs of edge pixels, no stats}"
+  "{T trace        |    | time every stage (build with -DMYCV_TRACE), print a table and write Chrome trace events to this file}"
+  "{B backends     |    | stage=backend,... stages gray denoise sobel canny label threshold all, backends auto scalar simd threaded opencv auto+opencv, @file reads them}"
+  ;
+
+// One image on its way through the stages. Items are recycled, so their
+// Mats keep their memory from one image to the next.
+struct BatchItem {
+  size_t index; // into the input list
+  Mat image;
+  Mat edges, labels, stats, centroids;
+  int num_objects;
+  double compute_ms;
+  string backends; // the ones the stages ran with
+  string error;    // why the image could not be processed, empty if it was
+};
+
+// Results of one input, written by the encode thread that finished it
+struct BatchResult {
+  string status;
+  int num_objects;
+  double compute_ms;
+  string backends;
+  BatchResult() : status("not processed"), num_objects(0), compute_ms(0) {}
+};
+
+static bool EndsWith(const string& s, const string& suffix)
+{
+  return s.size() >= suffix.size() && s.compare(s.size()-suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static string Lower(string s)
+{
+  for (size_t i=0; i<s.size(); i++)
+    s[i] = (char)tolower(s[i]);
+  return s;
+}
+
+static bool IsImageFile(const string& path)
+{
+  static const char* const ext[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".pgm", ".ppm", ".pbm", ".webp" };
+  string p = Lower(path);
+  for (size_t i=0; i<sizeof(ext)/sizeof(ext[0]); i++)
+    if (EndsWith(p, ext[i]))
+      return true;
+  return false;
+}
+
+static bool IsDirectory(const string& path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Expand one command line input into files
+static void AddInputs(const string& arg, vector<string>& files)
+{
+  string a = Lower(arg);
+  if (EndsWith(a, ".txt") || EndsWith(a, ".lst")) {
+    ifstream list(arg.c_str());
+    if (!list)
+      cout << "Fail to open list: " << arg << endl;
+    string line;
+    while (getline(list, line)) {
+      if (!line.empty() && line[line.size()-1] == '\r')
+        line.erase(line.size()-1);
+      if (!line.empty() && line[0] != '#')
+        files.push_back(line);
+    }
+  } else if (arg.find_first_of("*?") != string::npos) {
+    vector<String> found;
+    glob(arg, found, false);
+    files.insert(files.end(), found.begin(), found.end());
+  } else if (IsDirectory(arg)) {
+    vector<String> found;
+    glob(arg, found, false);
+    for (size_t i=0; i<found.size(); i++)
+      if (IsImageFile(found[i]))
+        files.push_back(found[i]);
+  } else {
+    files.push_back(arg);
+  }
+}
+
+// Output names: the file name without directory and extension, made
+// unique by the input index when two inputs share a name
+static vector<string> OutputNames(const vector<string>& files)
+{
+  vector<string> names(files.size());
+  set<string> seen;
+  for (size_t i=0; i<files.size(); i++) {
+    string name = files[i];
+    size_t slash = name.find_last_of("/\\");
+    if (slash != string::npos)
+      name = name.substr(slash+1);
+    size_t dot = name.find_last_of('.');
+    if (dot != string::npos && dot > 0)
+      name = name.substr(0, dot);
+    if (!seen.insert(name).second) {
+      ostringstream unique;
+      unique << name << "_" << i;
+      name = unique.str();
+    }
+    names[i] = name;
+  }
+  return names;
+}
+
+// Bring a decoded image to what the pipeline takes: 8 or 16 bits with 1,
+// 3 or 4 channels. Float images (TIFF, EXR) are taken as 0..1.
+static void NormalizeInput(Mat& image)
+{
+  if (image.channels() == 2) { // gray and alpha
+    Mat gray;
+    extractChannel(image, gray, 0);
+    image = gray;
+  }
+  if (image.depth() == CV_32F || image.depth() == CV_64F)
+    image.convertTo(image, CV_8U, 255);
+  else if (image.depth() != CV_8U && image.depth() != CV_16U)
+    image.convertTo(image, CV_8U);
+}
+
+// The status of a failed image, on one line
+static string ErrorStatus(const string& what)
+{
+  string status = "error: " + what;
+  for (size_t i=0; i<status.size(); i++)
+    if (status[i] == '\n' || status[i] == '\r')
+      status[i] = ' ';
+  return status;
+}
+
+// A text field of summary.csv: quoted, with embedded quotes doubled, so
+// that paths and errors with commas or quotes stay one field
+static string CsvField(const string& text)
+{
+  string field = "\"";
+  for (size_t i=0; i<text.size(); i++) {
+    if (text[i] == '"')
+      field += '"';
+    field += text[i];
+  }
+  return field + "\"";
+}
+
+static bool WriteLabels(const string& prefix, const Mat& labels, int num_objects)
+{
+  if (num_objects <= 65536) {
+    Mat labels16;
+    if (labels.depth() == CV_16U)
+      labels16 = labels;
+    else
+      labels.convertTo(labels16, CV_16U);
+    return imwrite(prefix + "_labels.png", labels16);
+  }
+  FileStorage fs(prefix + "_labels.yml.gz", FileStorage::WRITE);
+  if (!fs.isOpened())
+    return false;
+  fs << "labels" << labels;
+  return true;
+}
+
+static bool WriteStats(const string& prefix, const Mat& stats, const Mat& centroids)
+{
+  ofstream csv((prefix + "_stats.csv").c_str());
+  csv << "label,left,top,width,height,area,perimeter,cx,cy" << endl;
+  csv << fixed << setprecision(2);
+  for (int i=1; i<stats.rows; i++) {
+    const int* s = stats.ptr<int>(i);
+    const double* c = centroids.ptr<double>(i);
+    csv << i << "," << s[CC_STAT_LEFT] << "," << s[CC_STAT_TOP] << "," << s[CC_STAT_WIDTH] << ","
+        << s[CC_STAT_HEIGHT] << "," << s[CC_STAT_AREA] << ",";
+    if (stats.cols > LABEL_STAT_PERIMETER) // not from the OpenCV label backend
+      csv << s[LABEL_STAT_PERIMETER];
+    csv << "," << c[0] << "," << c[1] << endl;
+  }
+  return (bool)csv;
+}
+
+/** @function main */
+int main( int argc, char** argv )
+{
+  // Parse command line
+  if (argc < 2) {
+    cout << "Canny edge detection & connected components over many images, without GUI:" << endl;
+    cout << argv[0] << " <images|globs|dirs|lists ...> -o=out_dir [-lo=30] [-hi=90] [-w=workers] [-io=threads] [-n=queue]"
+         << " [-c=4|8] [-l] [-f] [-s] [-m] [-q] [-k=median radius] [-r=box radius] [-e] [-B=stage=backend,...] [-T=trace.json]" << endl;
+    cout << "More information ... -[h help usage ?]" << endl;
+    return -1;
+  }
+
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("Canny edge detection and connected components over many images, without GUI.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  // every argument that is not an option is an input
+  vector<string> files;
+  for (int i=1; i<argc; i++)
+    if (argv[i][0] != '-')
+      AddInputs(argv[i], files);
+  string out_dir = parser.get<String>("o");
+  if (files.empty() || out_dir.empty()) {
+    cout << "No input images or no output directory (-o=out_dir)" << endl;
+    return -1;
+  }
+  if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    cout << "Fail to create directory: " << out_dir << endl;
+    return -1;
+  }
+
+  int lo_threshold = parser.get<int>("lo");
+  int hi_threshold = parser.get<int>("hi");
+  int workers = parser.get<int>("w");
+  if (workers <= 0)
+    workers = getNumberOfCPUs();
+  int io_threads = max(1, parser.get<int>("io"));
+  int queue = parser.get<int>("n");
+  if (queue <= 0)
+    queue = 2*(workers + 2*io_threads);
+  cout << files.size() << " images, thresholds= " << lo_threshold << "/" << hi_threshold << ", workers= " << workers
+       << ", io threads= " << io_threads << ", images in flight= " << queue << endl;
+
+  CannyOptions canny_opts;
+  canny_opts.L2gradient = parser.has("l");
+  canny_opts.fused = parser.has("f");
+  if (parser.has("s"))
+    canny_opts.hysteresis = CANNY_HYST_SINGLE_PASS;
+  if (parser.has("m"))
+    canny_opts.mag_depth = CV_16U;
+  if (parser.has("q"))
+    canny_opts.nms = CANNY_NMS_QUANTIZED;
+  uint connectivity = parser.get<int>("c");
+  int median_radius = parser.get<int>("k");
+  int box_radius = parser.get<int>("r");
+  bool edge_runs = parser.has("e");
+  Backend backends[PIPE_STAGES];
+  DefaultBackends(backends);
+  string error;
+  if (parser.has("B") && !ParseBackends(parser.get<String>("B"), backends, error)) {
+    cout << "Bad backends: " << error << endl;
+    return -1;
+  }
+  // The images are the parallelism: under setNumThreads(1) below the tiled
+  // Canny and the strip labeling would only add their band overhead, and
+  // the threaded Otsu runs serially.
+  for (int s=PIPE_CANNY; s<=PIPE_LABEL; s++)
+    if (backends[s] == BACKEND_THREADED || backends[s] == BACKEND_AUTO || backends[s] == BACKEND_AUTO_OPENCV) {
+      cout << "Bad backends: canny and label cannot be threaded or auto in batch mode" << endl;
+      return -1;
+    }
+  // checked here, the labelers would fail every image on it
+  if (connectivity != 4 && connectivity != 8) {
+    cout << "Bad connectivity: " << connectivity << ", 4 or 8 only" << endl;
+    return -1;
+  }
+  String trace_file = parser.has("T") ? parser.get<String>("T") : String();
+  if (!parser.check()) {
+    parser.printErrors();
+    return -1;
+  }
+#ifdef MYCV_TRACE
+  TraceEnable(!trace_file.empty());
+#else
+  if (!trace_file.empty()) {
+    cout << "built without MYCV_TRACE, -T records nothing" << endl;
+    trace_file.clear();
+  }
+#endif
+  cout << "backends= " << BackendsString(backends) << endl;
+
+  // The images are the parallelism: every stage runs serially inside
+  setNumThreads(1);
+
+  const vector<string> names = OutputNames(files);
+  vector<BatchResult> results(files.size());
+  vector<BatchItem> pool(queue);
+  WorkQueue<BatchItem*> free_items(queue), decoded(queue), computed(queue);
+  for (int i=0; i<queue; i++)
+    free_items.Push(&pool[i]);
+  atomic<size_t> next_input(0);
+
+  int64 t0 = getTickCount();
+
+  // Decode
+  vector<thread> decoders;
+  for (int t=0; t<io_threads; t++)
+    decoders.push_back(thread([&] {
+      MYCV_TRACE_THREAD("decode");
+      for (size_t i = next_input++; i < files.size(); i = next_input++) {
+        BatchItem* item;
+        free_items.Pop(item);
+        item->index = i;
+        item->error.clear();
+        try {
+          MYCV_TRACE_SCOPE("imread", 0);
+          // no alpha, but 16-bit and float images keep their depth
+          item->image = imread(files[i], IMREAD_ANYDEPTH | IMREAD_ANYCOLOR);
+          if (item->image.data)
+            NormalizeInput(item->image);
+        } catch (const cv::Exception& e) {
+          item->image.release();
+          item->error = ErrorStatus(e.err);
+        }
+        decoded.Push(item);
+      }
+    }));
+
+  // Compute, one context per thread so that its buffers are reused
+  vector<thread> computers;
+  for (int t=0; t<workers; t++)
+    computers.push_back(thread([&] {
+      MYCV_TRACE_THREAD("compute");
+      CannyContext ctx;
+      ctx.canny_opts = canny_opts;
+      ctx.connectivity = connectivity;
+      ctx.median_radius = median_radius;
+      ctx.box_radius = box_radius;
+      ctx.edge_runs = edge_runs;
+      for (int s=0; s<PIPE_STAGES; s++)
+        ctx.backends[s] = backends[s];
+      BatchItem* item;
+      while (decoded.Pop(item)) {
+        // a bad image fails alone, the batch goes on
+        if (item->image.data) {
+          try {
+            int64 start = getTickCount();
+            ctx.SetImage(item->image);
+            ctx.Detect(lo_threshold, hi_threshold);
+            ctx.edges.copyTo(item->edges);
+            ctx.edge_labels.copyTo(item->labels);
+            ctx.edge_stats.copyTo(item->stats);
+            ctx.edge_centroids.copyTo(item->centroids);
+            item->num_objects = ctx.num_edge_objects;
+            item->compute_ms = (getTickCount() - start) * 1000. / getTickFrequency();
+            item->backends = BackendsString(ctx.selected);
+          } catch (const cv::Exception& e) {
+            item->error = ErrorStatus(e.err);
+          }
+        }
+        computed.Push(item);
+      }
+    }));
+
+  // Encode
+  vector<thread> encoders;
+  for (int t=0; t<io_threads; t++)
+    encoders.push_back(thread([&] {
+      MYCV_TRACE_THREAD("encode");
+      BatchItem* item;
+      while (computed.Pop(item)) {
+        MYCV_TRACE_SCOPE("write outputs", 0);
+        BatchResult& result = results[item->index];
+        string prefix = out_dir + "/" + names[item->index];
+        if (!item->error.empty()) {
+          result.status = item->error;
+        } else if (!item->image.data) {
+          result.status = "cannot read";
+        } else {
+          try {
+            result.num_objects = item->num_objects;
+            result.compute_ms = item->compute_ms;
+            result.backends = item->backends;
+            bool ok = imwrite(prefix + "_edges.png", item->edges) &&
+                      WriteLabels(prefix, item->labels, item->num_objects) &&
+                      (item->stats.empty() || WriteStats(prefix, item->stats, item->centroids));
+            result.status = ok ? "ok" : "cannot write";
+          } catch (const cv::Exception& e) {
+            result.status = ErrorStatus(e.err);
+          }
+        }
+        free_items.Push(item);
+      }
+    }));
+
+  for (size_t t=0; t<decoders.size(); t++)
+    decoders[t].join();
+  decoded.Close();
+  for (size_t t=0; t<computers.size(); t++)
+    computers[t].join();
+  computed.Close();
+  for (size_t t=0; t<encoders.size(); t++)
+    encoders[t].join();
+
+  double seconds = (getTickCount() - t0) / getTickFrequency();
+
+  int failed = 0;
+  ofstream summary((out_dir + "/summary.csv").c_str());
+  summary << "input,output,status,objects,compute_ms,backends" << endl;
+  summary << fixed << setprecision(3);
+  for (size_t i=0; i<files.size(); i++) {
+    const BatchResult& r = results[i];
+    summary << CsvField(files[i]) << "," << CsvField(names[i]) << "," << CsvField(r.status) << "," << r.num_objects << ","
+            << r.compute_ms << "," << CsvField(r.backends) << endl;
+    if (r.status != "ok") {
+      cout << files[i] << ": " << r.status << endl;
+      failed++;
+    }
+  }
+
+  cout << files.size() - failed << " images done, " << failed << " failed, " << fixed << setprecision(2) << seconds
+       << " s, " << (seconds > 0 ? files.size() / seconds : 0.) << " images/s" << endl;
+  if (!trace_file.empty()) {
+    TracePrintSummary(cout);
+    if (!TraceWriteChrome(trace_file)) {
+      cout << "Fail to write: " << trace_file << endl;
+      return -1;
+    }
+  }
+  return failed ? 1 : 0;
+}
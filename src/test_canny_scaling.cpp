@@ -0,0 +1,91 @@
+// Canny scaling test ---
+// Run MyCanny serially and in tiled mode with 1..N threads, check that the
+// tiled output is identical to the serial one and print time and speedup.
+// By Steven Chen
+
+#include "MyCanny.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cfloat>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |      | print this message    }"
+  "{@image_file    |      | image file, a synthetic image is used if omitted}"
+  "{W width        | 3840 | synthetic image width }"
+  "{H height       | 2160 | synthetic image height}"
+  "{n threads      | 0    | max threads, 0 = number of CPUs}"
+  "{b band         | 0    | band height, 0 = auto }"
+  "{r repeat       | 5    | runs per measurement, best one is reported}"
+  "{l l2gradient   |      | L2gradient=true or false}"
+  "{f fused        |      | stream rows through 3-row buffers}"
+  ;
+
+// best of repeat runs, in ms
+static double TimeCanny(const Mat& src, Mat& edges, const CannyOptions& opts, int repeat)
+{
+  double best = DBL_MAX;
+  for (int i=0; i<repeat; i++) {
+    int64 t0 = getTickCount();
+    MyCanny(src, edges, 30, 90, opts);
+    double ms = (getTickCount() - t0) * 1000. / getTickFrequency();
+    best = min(best, ms);
+  }
+  return best;
+}
+
+int main(int argc, char** argv)
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("MyCanny thread scaling test.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  Mat src;
+  String filename = parser.get<String>(0);
+  if (!filename.empty()) {
+    src = imread(filename, IMREAD_GRAYSCALE);
+    if (!src.data) {
+      cout << "Fail to open file: " << filename << endl;
+      return -1;
+    }
+  } else {
+    src.create(parser.get<int>("H"), parser.get<int>("W"), CV_8UC1);
+    RNG rnd_num(12345);
+    rnd_num.fill(src, RNG::UNIFORM, 0, 256);
+    blur(src, src, Size(5, 5));
+  }
+  int max_threads = parser.get<int>("n");
+  if (max_threads <= 0)
+    max_threads = getNumberOfCPUs();
+  int repeat = max(1, parser.get<int>("r"));
+
+  CannyOptions opts;
+  opts.L2gradient = parser.has("l");
+  opts.band_height = parser.get<int>("b");
+  opts.fused = parser.has("f");
+  cout << "image " << src.cols << "x" << src.rows << ", L2gradient=" << opts.L2gradient << ", fused=" << opts.fused << endl;
+
+  Mat serial_edges;
+  opts.exec = CANNY_EXEC_SERIAL;
+  double serial_ms = TimeCanny(src, serial_edges, opts, repeat);
+  cout << "serial: " << fixed << setprecision(2) << serial_ms << " ms" << endl;
+
+  cout << "threads      ms  speedup  identical" << endl;
+  opts.exec = CANNY_EXEC_TILED;
+  for (int n=1; n<=max_threads; n++) {
+    Mat edges;
+    opts.num_threads = n;
+    double ms = TimeCanny(src, edges, opts, repeat);
+    bool identical = countNonZero(edges != serial_edges) == 0;
+    cout << setw(7) << n << setw(8) << setprecision(2) << ms << setw(9) << serial_ms/ms
+         << setw(11) << (identical ? "yes" : "NO") << endl;
+  }
+  return 0;
+}
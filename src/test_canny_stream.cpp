@@ -0,0 +1,323 @@
+/*
+  Topic: Canny Edge Detection on a stream of frames
+    Frames come from cv::VideoCapture: a video file, an image sequence
+    (img_%03d.png) or a camera index.
+
+ * Every stage of the pipeline runs on its own thread and works on its own
+   frame: capture -> gray -> median -> box -> Canny -> label -> display.
+ * Neighbouring stages hand frames over through lock-free SPSC rings
+   (SpscRing.hpp) of -n frames. A full ring holds the stage before it
+   back, so a slow stage slows the capture down instead of queueing frames.
+ * Frames live in a fixed pool of slots that returns to the capture
+   thread through one more ring. Every stage keeps its own scratch
+   buffers, so the steady state does not allocate.
+ * A frame that a stage fails on keeps going with its error: the stages
+   after it skip it, so the pipeline drains, and the error is printed
+   when the frame comes out. A capture error ends the stream.
+ * At the end it prints each stage's time per frame, the time frames
+   waited in front of it, how often it was held back by a full ring, the
+   end-to-end latency and the throughput in FPS.
+
+  Author: Steven Chen
+*/
+
+#include "define.hpp"
+#include "MyCanny.hpp"
+#include "MyFilter.hpp"
+#include "LabelConnected.hpp"
+#include "LabelSets.hpp"
+#include "SpscRing.hpp"
+#include "Trace.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |    | print this message    }"
+  "{@input         | 0  | video file, image sequence (img_%03d.png) or camera index}"
+  "{lo low         | 30 | low hysteresis threshold }"
+  "{hi high        | 90 | high hysteresis threshold}"
+  "{n ring         | 2  | frames in each ring between two stages}"
+  "{N frames       | 0  | stop after this many frames, 0 = end of the stream}"
+  "{d display      |    | show the edges, ESC stops}"
+  "{c connectivity | 8  | connectivity=4 or 8 only}"
+  "{l l2gradient   |    | L2gradient=true or false}"
+  "{j threads      | 1  | MyCanny threads, >1 runs it tiled, 0 = all cores}"
+  "{f fused        |    | MyCanny streams rows through 3-row buffers}"
+  "{s single       |    | MyCanny single-pass hysteresis instead of edge tracking}"
+  "{m mag16        |    | MyCanny keeps the gradient magnitude in 16 bits (no clipping at 255)}"
+  "{q quantized    |    | MyCanny NMS with 4 quantized directions instead of interpolation}"
+  "{k median_radius| 1  | MedianFilter radius, 1 = 3x3}"
+  "{r box_radius   | 0  | BoxFilter radius, 0 = 3x3 average of the 8 neighbours}"
+  "{e edge_runs    |    | label the edges by runs of edge pixels, the background is not labeled}"
+  "{T trace        |    | time the kernels of every stage (build with -DMYCV_TRACE), print a table and write Chrome trace events to this file}"
+  ;
+
+enum StreamStage { STAGE_CAPTURE = 0, STAGE_GRAY, STAGE_MEDIAN, STAGE_BOX, STAGE_CANNY, STAGE_LABEL, STAGE_COUNT };
+static const char* const stage_names[STAGE_COUNT] = { "capture", "gray", "median", "box", "canny", "label" };
+
+// One frame and the output of every stage, recycled through the pipeline
+struct FrameSlot {
+  long frame_no; // -1 ends the stream
+  Mat frame, gray, median, smoothed, edges, labels;
+  int num_objects;
+  int64 start[STAGE_COUNT], end[STAGE_COUNT]; // tick counts of every stage
+  string error; // the stage that failed on the frame and why, empty if none
+};
+
+// Per-stage timing of the frames that reached the end
+struct StageTimes {
+  double busy, busy_max, wait; // ms
+  StageTimes() : busy(0), busy_max(0), wait(0) {}
+};
+
+// One stage on its own thread: pop a frame, work on it, push it on.
+// The end-of-stream slot and failed frames are passed on untouched; an
+// exception fails the frame, not the thread, so the rings keep draining.
+template<typename Work> static void RunStage(StreamStage stage, SpscRing<FrameSlot*>& in, SpscRing<FrameSlot*>& out, Work work)
+{
+  MYCV_TRACE_THREAD(stage_names[stage]); // the kernels are traced inside
+  for (;;) {
+    FrameSlot* slot;
+    in.Pop(slot);
+    if (slot->frame_no >= 0 && slot->error.empty()) {
+      slot->start[stage] = getTickCount();
+      try {
+        work(*slot);
+      } catch (const cv::Exception& e) {
+        slot->error = string(stage_names[stage]) + ": error: " + e.err;
+      }
+      slot->end[stage] = getTickCount();
+    }
+    out.Push(slot);
+    if (slot->frame_no < 0)
+      return;
+  }
+}
+
+static double TicksToMs(int64 ticks)
+{
+  return ticks * 1000. / getTickFrequency();
+}
+
+/** @function main */
+int main( int argc, char** argv )
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("Canny edge detection and connected components on a video stream, one thread per stage.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  String input = parser.get<String>(0);
+  int lo_threshold = parser.get<int>("lo");
+  int hi_threshold = parser.get<int>("hi");
+  int ring_size = max(1, parser.get<int>("n"));
+  long max_frames = parser.get<int>("N"); // CommandLineParser has no long
+  bool display = parser.has("d");
+
+  CannyOptions canny_opts;
+  canny_opts.L2gradient = parser.has("l");
+  int threads = parser.get<int>("j");
+  if (threads != 1) {
+    canny_opts.exec = CANNY_EXEC_TILED;
+    canny_opts.num_threads = threads;
+  }
+  canny_opts.fused = parser.has("f");
+  if (parser.has("s"))
+    canny_opts.hysteresis = CANNY_HYST_SINGLE_PASS;
+  if (parser.has("m"))
+    canny_opts.mag_depth = CV_16U;
+  if (parser.has("q"))
+    canny_opts.nms = CANNY_NMS_QUANTIZED;
+  uint connectivity = parser.get<int>("c");
+  int median_radius = parser.get<int>("k");
+  int box_radius = parser.get<int>("r");
+  bool edge_runs = parser.has("e");
+  String trace_file = parser.has("T") ? parser.get<String>("T") : String();
+  if (!parser.check()) {
+    parser.printErrors();
+    return -1;
+  }
+#ifdef MYCV_TRACE
+  TraceEnable(!trace_file.empty());
+#else
+  if (!trace_file.empty()) {
+    cout << "built without MYCV_TRACE, -T records nothing" << endl;
+    trace_file.clear();
+  }
+#endif
+
+  // a number is a camera
+  VideoCapture cap;
+  if (!input.empty() && input.find_first_not_of("0123456789") == String::npos)
+    cap.open(atoi(input.c_str()));
+  else
+    cap.open(input);
+  if (!cap.isOpened()) {
+    cout << "Fail to open stream: " << input << endl;
+    return -1;
+  }
+  cout << "stream= " << input << ", thresholds= " << lo_threshold << "/" << hi_threshold
+       << ", ring= " << ring_size << " frames" << endl;
+
+  // rings[s] leads from stage s to stage s+1, the last one to the display
+  // loop; every slot can be in a ring or at a stage at the same time
+  vector<SpscRing<FrameSlot*>*> rings;
+  for (int s=0; s<STAGE_COUNT; s++)
+    rings.push_back(new SpscRing<FrameSlot*>(ring_size));
+  const int num_slots = STAGE_COUNT*(ring_size+1) + 1;
+  vector<FrameSlot> slots(num_slots);
+  SpscRing<FrameSlot*> free_slots(num_slots);
+  for (int i=0; i<num_slots; i++)
+    free_slots.Push(&slots[i]);
+  atomic<bool> stop(false);
+  string capture_error; // written by the capture thread, read after it ended
+
+  vector<thread> stages;
+  stages.push_back(thread([&] {
+    MYCV_TRACE_THREAD(stage_names[STAGE_CAPTURE]);
+    for (long n=0; ; n++) {
+      FrameSlot* slot;
+      free_slots.Pop(slot);
+      slot->start[STAGE_CAPTURE] = getTickCount();
+      MYCV_TRACE_SCOPE("capture", 0);
+      slot->error.clear();
+      bool read = false;
+      try {
+        read = !stop && (max_frames <= 0 || n < max_frames) && cap.read(slot->frame) && !slot->frame.empty();
+      } catch (const cv::Exception& e) {
+        capture_error = e.err;
+      }
+      if (!read) {
+        slot->frame_no = -1;
+        rings[STAGE_CAPTURE]->Push(slot);
+        return;
+      }
+      slot->frame_no = n;
+      slot->end[STAGE_CAPTURE] = getTickCount();
+      rings[STAGE_CAPTURE]->Push(slot);
+    }
+  }));
+  stages.push_back(thread([&] {
+    RunStage(STAGE_GRAY, *rings[STAGE_CAPTURE], *rings[STAGE_GRAY], [&](FrameSlot& f) {
+      MyColorToGray(f.frame, f.gray, false, canny_opts.simd);
+    });
+  }));
+  stages.push_back(thread([&] {
+    FilterBuf buf;
+    RunStage(STAGE_MEDIAN, *rings[STAGE_GRAY], *rings[STAGE_MEDIAN], [&](FrameSlot& f) {
+      MedianFilter(f.gray, f.median, median_radius, buf, canny_opts.simd);
+    });
+  }));
+  stages.push_back(thread([&] {
+    FilterBuf buf;
+    RunStage(STAGE_BOX, *rings[STAGE_MEDIAN], *rings[STAGE_BOX], [&](FrameSlot& f) {
+      if (box_radius > 0)
+        BoxFilter(f.median, f.smoothed, box_radius, false, buf, canny_opts.simd);
+      else
+        BoxFilter(f.median, f.smoothed, 1, true, buf, canny_opts.simd);
+    });
+  }));
+  stages.push_back(thread([&] {
+    CannyBuf buf;
+    RunStage(STAGE_CANNY, *rings[STAGE_BOX], *rings[STAGE_CANNY], [&](FrameSlot& f) {
+      MyCanny(f.smoothed, f.edges, lo_threshold, hi_threshold, canny_opts, buf);
+    });
+  }));
+  stages.push_back(thread([&] {
+    LabelBuf buf;
+    RunStage(STAGE_LABEL, *rings[STAGE_CANNY], *rings[STAGE_LABEL], [&](FrameSlot& f) {
+      if (edge_runs)
+        f.num_objects = LabelRuns(f.edges, f.labels, buf, connectivity);
+      else
+        f.num_objects = LabelConnected(f.edges, f.labels, buf, connectivity);
+    });
+  }));
+
+  // Display loop: collect the timings and recycle the slots
+  StageTimes times[STAGE_COUNT];
+  double latency = 0, latency_max = 0;
+  long frames = 0, failed = 0;
+  int64 first_start = 0, last_end = 0;
+  MYCV_TRACE_THREAD("display");
+  for (;;) {
+    FrameSlot* slot;
+    rings[STAGE_LABEL]->Pop(slot);
+    if (slot->frame_no < 0)
+      break;
+    if (!slot->error.empty()) {
+      cout << "frame " << slot->frame_no << ": " << slot->error << endl;
+      failed++;
+      free_slots.Push(slot);
+      continue;
+    }
+    for (int s=0; s<STAGE_COUNT; s++) {
+      double busy = TicksToMs(slot->end[s] - slot->start[s]);
+      times[s].busy += busy;
+      times[s].busy_max = max(times[s].busy_max, busy);
+      if (s > 0)
+        times[s].wait += TicksToMs(slot->start[s] - slot->end[s-1]);
+    }
+    double e2e = TicksToMs(slot->end[STAGE_LABEL] - slot->start[STAGE_CAPTURE]);
+    latency += e2e;
+    latency_max = max(latency_max, e2e);
+    if (frames == 0)
+      first_start = slot->start[STAGE_CAPTURE];
+    last_end = slot->end[STAGE_LABEL];
+    frames++;
+
+    if (display) {
+      imshow("Canny edges", slot->edges);
+      if (waitKey(1) == 27)
+        stop = true;
+    }
+    if (slot->frame_no % 100 == 0)
+      cout << "frame " << slot->frame_no << ": num_objects = " << slot->num_objects
+           << ", latency = " << fixed << setprecision(2) << e2e << " ms" << endl;
+    free_slots.Push(slot);
+  }
+  for (size_t t=0; t<stages.size(); t++)
+    stages[t].join();
+  if (!capture_error.empty())
+    cout << "capture: error: " << capture_error << endl;
+
+  if (frames == 0) {
+    cout << (failed ? "No frame processed" : "No frame read") << endl;
+    return -1;
+  }
+  // busy: time in the stage, wait: time in the ring in front of it,
+  // held back: times the stage found the ring after it full
+  cout << endl << left << setw(10) << "stage" << right << setw(12) << "busy ms" << setw(12) << "max ms"
+       << setw(12) << "wait ms" << setw(12) << "held back" << endl;
+  cout << fixed << setprecision(3);
+  for (int s=0; s<STAGE_COUNT; s++)
+    cout << left << setw(10) << stage_names[s] << right << setw(12) << times[s].busy / frames
+         << setw(12) << times[s].busy_max << setw(12) << times[s].wait / frames << setw(12) << rings[s]->FullWaits() << endl;
+  double seconds = TicksToMs(last_end - first_start) / 1000.;
+  cout << "end-to-end latency: " << latency / frames << " ms mean, " << latency_max << " ms max" << endl;
+  cout << "throughput: " << setprecision(2) << (seconds > 0 ? frames / seconds : 0.) << " fps ("
+       << frames << " frames in " << seconds << " s)" << endl;
+  if (failed || !capture_error.empty())
+    cout << failed << " frames failed" << (capture_error.empty() ? "" : ", the capture failed") << endl;
+  if (!trace_file.empty()) {
+    cout << endl;
+    TracePrintSummary(cout);
+    if (!TraceWriteChrome(trace_file))
+      cout << "Fail to write: " << trace_file << endl;
+  }
+
+  for (int s=0; s<STAGE_COUNT; s++)
+    delete rings[s];
+  if (display)
+    destroyAllWindows();
+  return failed || !capture_error.empty() ? 1 : 0;
+}
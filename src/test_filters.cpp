@@ -0,0 +1,228 @@
+// Filter test ---
+// Compare mycv::Median, Box and Sobel with reference filters computed on
+// a cv::copyMakeBorder copy of the image, for every border mode and
+// radius, on tiny images (fewer rows or columns than the radius, a single
+// column), in place, and on ImageView regions of a buffer whose stride is
+// wider than the image. Also checks that the ImageView calls never write
+// outside their output or into their input.
+// By Steven Chen
+
+#include "CannyLib.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |       | print this message }"
+  "{s seed         | 12345 | random seed        }"
+  ;
+
+enum Filter { FILTER_MEDIAN, FILTER_BOX, FILTER_SOBEL, FILTER_COUNT };
+static const char* const filter_names[FILTER_COUNT] = { "Median", "Box", "Sobel" };
+static const int max_radius[FILTER_COUNT] = { 5, 4, 1 };
+
+static const int borders[] = { BORDER_REPLICATE, BORDER_REFLECT, BORDER_REFLECT_101, BORDER_CONSTANT };
+static const char* const border_names[] = { "replicate", "reflect", "reflect_101", "constant" };
+static const int num_borders = sizeof(borders)/sizeof(borders[0]);
+static const uchar border_value = 77;
+
+// width x height, down to fewer pixels than a window
+static const int sizes[][2] = { {1,1}, {1,9}, {9,1}, {2,3}, {5,4}, {37,23}, {131,41} };
+
+// The reference: the plain definition of the filter on the padded image.
+// Median and Box: CV_8UC1 result. Sobel: gx and gy, CV_16SC1.
+static void Reference(Filter filter, const Mat& src, int radius, int border, Mat& dst, Mat& dst_y)
+{
+  int r = filter == FILTER_MEDIAN ? radius : max(radius, 1);
+  Mat padded;
+  copyMakeBorder(src, padded, r, r, r, r, border, Scalar::all(border_value));
+  vector<uchar> window;
+  if (filter == FILTER_SOBEL) {
+    dst.create(src.size(), CV_16SC1);
+    dst_y.create(src.size(), CV_16SC1);
+  } else {
+    dst.create(src.size(), CV_8UC1);
+  }
+  int area = (2*r+1)*(2*r+1);
+  for (int y=0; y<src.rows; y++)
+    for (int x=0; x<src.cols; x++) {
+      const Mat win = padded(Rect(x, y, 2*r+1, 2*r+1));
+      if (filter == FILTER_MEDIAN) {
+        window.clear();
+        for (int i=0; i<win.rows; i++)
+          window.insert(window.end(), win.ptr<uchar>(i), win.ptr<uchar>(i) + win.cols);
+        nth_element(window.begin(), window.begin() + area/2, window.end());
+        dst.at<uchar>(y, x) = window[area/2];
+      } else if (filter == FILTER_BOX) {
+        int sum = 0;
+        for (int i=0; i<win.rows; i++)
+          for (int j=0; j<win.cols; j++)
+            sum += win.at<uchar>(i, j);
+        // radius 0: the 8 neighbours, truncated; otherwise rounded
+        dst.at<uchar>(y, x) = radius == 0 ? (uchar)((sum - win.at<uchar>(1, 1)) / 8) : (uchar)((2*sum + area) / (2*area));
+      } else {
+        int p[3][3];
+        for (int i=0; i<3; i++)
+          for (int j=0; j<3; j++)
+            p[i][j] = win.at<uchar>(i, j);
+        dst.at<short>(y, x) = (short)(p[0][2] + 2*p[1][2] + p[2][2] - p[0][0] - 2*p[1][0] - p[2][0]);
+        dst_y.at<short>(y, x) = (short)(p[2][0] + 2*p[2][1] + p[2][2] - p[0][0] - 2*p[0][1] - p[0][2]);
+      }
+    }
+}
+
+static void Run(Filter filter, const Mat& src, int radius, int border, Mat& dst, Mat& dst_y, mycv::Workspace& ws)
+{
+  if (filter == FILTER_MEDIAN)
+    mycv::Median(src, dst, radius, ws, border, border_value);
+  else if (filter == FILTER_BOX)
+    mycv::Box(src, dst, radius, ws, border, border_value);
+  else
+    mycv::Sobel(src, dst, dst_y, ws, border, border_value);
+}
+
+static void RunView(Filter filter, const mycv::ImageView& src, int radius, int border, const mycv::ImageView& dst,
+                    const mycv::ImageView& dst_y, mycv::Workspace& ws)
+{
+  if (filter == FILTER_MEDIAN)
+    mycv::Median(src, dst, radius, ws, border, border_value);
+  else if (filter == FILTER_BOX)
+    mycv::Box(src, dst, radius, ws, border, border_value);
+  else
+    mycv::Sobel(src, dst, dst_y, ws, border, border_value);
+}
+
+static int Differ(const Mat& a, const Mat& b)
+{
+  return a.size() == b.size() && a.type() == b.type() ? countNonZero(a.reshape(1) != b.reshape(1)) : (int)max(a.total(), b.total());
+}
+
+// Bytes of buf outside the rectangle roi (in bytes) that are not fill
+static int Outside(const vector<uchar>& buf, size_t stride, Rect roi, uchar fill)
+{
+  int n = 0;
+  for (size_t i=0; i<buf.size(); i++) {
+    int y = (int)(i / stride), x = (int)(i % stride);
+    n += !roi.contains(Point(x, y)) && buf[i] != fill;
+  }
+  return n;
+}
+
+// One filter, size, radius and border: Mat, in place and ImageView runs
+// against the reference. Returns the number of differing pixels.
+static int Check(Filter filter, int width, int height, int radius, int border, RNG& rng, mycv::Workspace& ws)
+{
+  Mat src(height, width, CV_8UC1), ref, ref_y;
+  rng.fill(src, RNG::UNIFORM, 0, 256);
+  Reference(filter, src, radius, border, ref, ref_y);
+  int bad = 0;
+
+  Mat dst, dst_y;
+  Run(filter, src, radius, border, dst, dst_y, ws);
+  bad += Differ(dst, ref);
+  if (filter == FILTER_SOBEL)
+    bad += Differ(dst_y, ref_y);
+  else {
+    Mat in_place = src.clone();
+    Run(filter, in_place, radius, border, in_place, dst_y, ws);
+    bad += Differ(in_place, ref);
+  }
+
+  // the image as a region of a larger frame with random pixels around
+  // it, written into a region of a padded output buffer
+  const int x0 = 3, y0 = 2;
+  const size_t in_stride = width + 11;
+  const int out_depth = filter == FILTER_SOBEL ? CV_16SC1 : CV_8UC1;
+  const size_t out_elem = filter == FILTER_SOBEL ? 2 : 1;
+  const size_t out_stride = (width + 5) * out_elem;
+  vector<uchar> frame(in_stride * (height + 5)), out((height + 3) * out_stride, 0xA5), out_y(out);
+  rng.fill(Mat(1, (int)frame.size(), CV_8UC1, &frame[0]), RNG::UNIFORM, 0, 256);
+  mycv::ImageView frame_view(&frame[0], width + 11, height + 5, in_stride);
+  mycv::ImageView roi = frame_view.Roi(x0, y0, width, height);
+  src.copyTo(roi.AsMat());
+  const vector<uchar> frame_before(frame);
+  mycv::ImageView out_view = mycv::ImageView(&out[0], width + 5, height + 3, out_stride, out_depth).Roi(1, 1, width, height);
+  mycv::ImageView out_y_view = mycv::ImageView(&out_y[0], width + 5, height + 3, out_stride, out_depth).Roi(1, 1, width, height);
+  RunView(filter, roi, radius, border, out_view, out_y_view, ws);
+  bad += Differ(out_view.AsMat(), ref);
+  bad += frame != frame_before;
+  Rect out_rect((int)out_elem, 1, (int)(width*out_elem), height);
+  bad += Outside(out, out_stride, out_rect, 0xA5);
+  if (filter == FILTER_SOBEL) {
+    bad += Differ(out_y_view.AsMat(), ref_y);
+    bad += Outside(out_y, out_stride, out_rect, 0xA5);
+  }
+  return bad;
+}
+
+// A gray view, then a color view of the same size through one Workspace:
+// the gray frame, e.g. shared memory of a capture process, stays as it was
+static int CheckInputsKept(RNG& rng)
+{
+  const int width = 64, height = 48;
+  vector<uchar> gray(width * height), color(width * height * 3), edges(width * height);
+  rng.fill(Mat(1, (int)gray.size(), CV_8UC1, &gray[0]), RNG::UNIFORM, 0, 256);
+  rng.fill(Mat(1, (int)color.size(), CV_8UC1, &color[0]), RNG::UNIFORM, 0, 256);
+  const vector<uchar> gray_before(gray), color_before(color);
+  mycv::Workspace ws;
+  mycv::CannyParams params;
+  mycv::ImageView edge_view(&edges[0], width, height, width);
+  mycv::Canny(mycv::ImageView(&gray[0], width, height, width), edge_view, params, ws);
+  mycv::Canny(mycv::ImageView(&color[0], width, height, width*3, CV_8UC3), edge_view, params, ws);
+  return (gray != gray_before) + (color != color_before);
+}
+
+// Label of a view with stats against the cv::Mat call
+static int CheckLabelView(RNG& rng)
+{
+  const int width = 50, height = 40;
+  Mat img(height, width, CV_8UC1);
+  rng.fill(img, RNG::UNIFORM, 0, 3);
+  vector<int> labels(width * height);
+  mycv::Workspace ws;
+  Mat stats, centroids, ref_labels, ref_stats, ref_centroids;
+  int n = mycv::Label(mycv::ImageView(img.data, width, height, img.step), mycv::ImageView(&labels[0], width, height, width*4, CV_32SC1),
+                      stats, centroids, ws);
+  int ref_n = mycv::Label(img, ref_labels, ref_stats, ref_centroids, ws);
+  return (n != ref_n) + Differ(Mat(height, width, CV_32SC1, &labels[0]), ref_labels) + Differ(stats, ref_stats) +
+         Differ(centroids, ref_centroids);
+}
+
+int main(int argc, char** argv)
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("mycv filter and ImageView test.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+  RNG rng(parser.get<int>("s"));
+  mycv::Workspace ws;
+  int failures = 0;
+
+  cout << "filter  border        radius  sizes   diff" << endl;
+  for (int f=0; f<FILTER_COUNT; f++)
+    for (int b=0; b<num_borders; b++)
+      for (int radius = f == FILTER_SOBEL ? 1 : 0; radius <= max_radius[f]; radius++) {
+        int bad = 0, num_sizes = sizeof(sizes)/sizeof(sizes[0]);
+        for (int s=0; s<num_sizes; s++)
+          bad += Check((Filter)f, sizes[s][0], sizes[s][1], radius, borders[b], rng, ws);
+        failures += bad;
+        cout << left << setw(8) << filter_names[f] << setw(14) << border_names[b] << right << setw(6)
+             << (f == FILTER_SOBEL ? 1 : radius) << setw(7) << num_sizes << setw(7) << bad << endl;
+      }
+
+  int bad = CheckInputsKept(rng);
+  cout << "gray then color view, inputs kept: " << (bad ? "NO" : "yes") << endl;
+  failures += bad;
+  bad = CheckLabelView(rng);
+  cout << "Label of a view with stats: " << (bad ? "differs" : "same") << endl;
+  failures += bad;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Hysteresis test ---
+// Compare the single-pass hysteresis of MyCanny with edge tracking (serial
+// and tiled) and with OpenCV's Canny: time of the whole detector and the
+// number of pixels that differ from cv::Canny.
+// By Steven Chen
+
+#include "MyCanny.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cfloat>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |      | print this message    }"
+  "{@image_file    |      | image file, a synthetic image is used if omitted}"
+  "{W width        | 3840 | synthetic image width }"
+  "{H height       | 2160 | synthetic image height}"
+  "{lo             | 30   | low threshold         }"
+  "{hi             | 90   | high threshold        }"
+  "{n threads      | 0    | threads of the tiled run, 0 = number of CPUs}"
+  "{r repeat       | 5    | runs per measurement, best one is reported}"
+  "{l l2gradient   |      | L2gradient=true or false}"
+  ;
+
+struct CannyRun {
+  string name;
+  CannyOptions opts;
+  bool ocv;
+};
+
+int main(int argc, char** argv)
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("MyCanny hysteresis test.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  Mat src;
+  String filename = parser.get<String>(0);
+  if (!filename.empty()) {
+    src = imread(filename, IMREAD_GRAYSCALE);
+    if (!src.data) {
+      cout << "Fail to open file: " << filename << endl;
+      return -1;
+    }
+  } else {
+    src.create(parser.get<int>("H"), parser.get<int>("W"), CV_8UC1);
+    RNG rnd_num(12345);
+    rnd_num.fill(src, RNG::UNIFORM, 0, 256);
+    blur(src, src, Size(5, 5));
+  }
+  int lo_threshold = parser.get<int>("lo");
+  int hi_threshold = parser.get<int>("hi");
+  int threads = parser.get<int>("n");
+  int repeat = max(1, parser.get<int>("r"));
+  bool L2gradient = parser.has("l");
+
+  vector<CannyRun> runs;
+  CannyRun run;
+  run.ocv = false;
+  run.opts.L2gradient = L2gradient;
+  run.name = "single pass";
+  run.opts.hysteresis = CANNY_HYST_SINGLE_PASS;
+  runs.push_back(run);
+  run.name = "tracking";
+  run.opts.hysteresis = CANNY_HYST_TRACE;
+  runs.push_back(run);
+  run.name = "tracking, tiled";
+  run.opts.exec = CANNY_EXEC_TILED;
+  run.opts.num_threads = threads > 0 ? threads : getNumberOfCPUs();
+  runs.push_back(run);
+  run.name = "cv::Canny";
+  run.ocv = true;
+  runs.push_back(run);
+
+  Mat ocv_edges;
+  Canny(src, ocv_edges, lo_threshold, hi_threshold, 3, L2gradient);
+
+  cout << "image " << src.cols << "x" << src.rows << ", thresholds " << lo_threshold << "/" << hi_threshold
+       << ", L2gradient=" << L2gradient << endl;
+  cout << "run                    ms    edges  diff to cv::Canny" << endl;
+  for (size_t i=0; i<runs.size(); i++) {
+    Mat edges;
+    double best = DBL_MAX;
+    for (int k=0; k<repeat; k++) {
+      int64 t0 = getTickCount();
+      if (runs[i].ocv)
+        Canny(src, edges, lo_threshold, hi_threshold, 3, L2gradient);
+      else
+        MyCanny(src, edges, lo_threshold, hi_threshold, runs[i].opts);
+      best = min(best, (getTickCount() - t0) * 1000. / getTickFrequency());
+    }
+    cout << left << setw(18) << runs[i].name << right << fixed << setprecision(2) << setw(9) << best
+         << setw(9) << countNonZero(edges) << setw(19) << countNonZero(edges != ocv_edges) << endl;
+  }
+  return 0;
+}
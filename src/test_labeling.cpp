@@ -0,0 +1,141 @@
+// Labeling test ---
+// Compare LabelRuns with LabelConnected on edge maps and on random sparse
+// images of every width up to 80 (the SSE2/AVX2 run tails), at 4 and 8
+// connectivity and on every SIMD path: the nonzero pixels must form the
+// same objects, one LabelRuns label for one LabelConnected label.
+// By Steven Chen
+
+#include "MyCanny.hpp"
+#include "LabelConnected.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cfloat>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+const String cmd_help =
+  "{h help usage ? |      | print this message    }"
+  "{@image_file    |      | image file, a synthetic image is used if omitted}"
+  "{W width        | 1920 | synthetic image width }"
+  "{H height       | 1080 | synthetic image height}"
+  "{lo             | 30   | low threshold of the edge map }"
+  "{hi             | 90   | high threshold of the edge map}"
+  "{r repeat       | 5    | runs per measurement, best one is reported}"
+  ;
+
+// Number of nonzero pixels where LabelRuns and LabelConnected disagree:
+// background not 0, or a label of one mapped to two labels of the other
+static int CompareLabels(const Mat& img, uint connectivity, SimdPath simd)
+{
+  Mat runs_labels, cc_labels;
+  int num_runs = LabelRuns(img, runs_labels, connectivity, CV_32S, simd);
+  int num_cc = LabelConnected(img, cc_labels, connectivity, 1, CV_32S);
+  vector<int> to_cc(num_runs, -1), to_runs(num_cc, -1);
+  int bad = 0;
+  for (int y=0; y<img.rows; y++) {
+    const uchar* p = img.ptr<uchar>(y);
+    const int* r = runs_labels.ptr<int>(y);
+    const int* c = cc_labels.ptr<int>(y);
+    for (int x=0; x<img.cols; x++) {
+      if (p[x] == 0) {
+        bad += r[x] != 0;
+        continue;
+      }
+      if (r[x] <= 0 || r[x] >= num_runs) {
+        bad++;
+        continue;
+      }
+      if (to_cc[r[x]] < 0)
+        to_cc[r[x]] = c[x];
+      if (to_runs[c[x]] < 0)
+        to_runs[c[x]] = r[x];
+      bad += to_cc[r[x]] != c[x] || to_runs[c[x]] != r[x];
+    }
+  }
+  // every object of LabelRuns is used: the same object count
+  for (int i=1; i<num_runs; i++)
+    bad += to_cc[i] < 0;
+  return bad;
+}
+
+int main(int argc, char** argv)
+{
+  CommandLineParser parser(argc, argv, cmd_help);
+  parser.about("LabelRuns test against LabelConnected.");
+  if (parser.has("?")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  Mat src;
+  String filename = parser.get<String>(0);
+  if (!filename.empty()) {
+    src = imread(filename, IMREAD_GRAYSCALE);
+    if (!src.data) {
+      cout << "Fail to open file: " << filename << endl;
+      return -1;
+    }
+  } else {
+    src.create(parser.get<int>("H"), parser.get<int>("W"), CV_8UC1);
+    RNG rnd_num(12345);
+    rnd_num.fill(src, RNG::UNIFORM, 0, 256);
+    blur(src, src, Size(5, 5));
+  }
+  int repeat = max(1, parser.get<int>("r"));
+  Mat edges;
+  MyCanny(src, edges, parser.get<int>("lo"), parser.get<int>("hi"));
+
+  const SimdPath paths[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+  const char* path_names[] = { "scalar", "sse2", "avx2" };
+  const uint conns[] = { 4, 8 };
+  int failures = 0;
+
+  // random sparse images: runs that end in the SIMD body, in the scalar
+  // tail and on the last column
+  RNG rng(7);
+  int small_bad = 0;
+  for (int cols=1; cols<=80; cols++) {
+    Mat img(9, cols, CV_8UC1);
+    for (int density=1; density<=3; density++) {
+      rng.fill(img, RNG::UNIFORM, 0, 4);
+      img = img < density;
+      for (int c=0; c<2; c++)
+        for (int p=0; p<3; p++)
+          small_bad += CompareLabels(img, conns[c], paths[p]);
+    }
+  }
+  cout << "random images 9x1 .. 9x80: " << (small_bad ? "FAIL" : "ok") << ", " << small_bad << " pixels differ" << endl;
+  failures += small_bad;
+
+  cout << "edge map " << edges.cols << "x" << edges.rows << ", " << countNonZero(edges) << " edge pixels" << endl;
+  cout << "labeler          conn    simd        ms  objects  diff" << endl;
+  for (int c=0; c<2; c++) {
+    Mat labels;
+    double best = DBL_MAX;
+    int num_objects = 0;
+    for (int k=0; k<repeat; k++) {
+      int64 t0 = getTickCount();
+      num_objects = LabelConnected(edges, labels, conns[c]);
+      best = min(best, (getTickCount() - t0) * 1000. / getTickFrequency());
+    }
+    cout << left << setw(16) << "LabelConnected" << right << setw(6) << conns[c] << setw(8) << "-"
+         << fixed << setprecision(2) << setw(10) << best << setw(9) << num_objects << setw(6) << "-" << endl;
+    for (int p=0; p<3; p++) {
+      best = DBL_MAX;
+      for (int k=0; k<repeat; k++) {
+        int64 t0 = getTickCount();
+        num_objects = LabelRuns(edges, labels, conns[c], -1, paths[p]);
+        best = min(best, (getTickCount() - t0) * 1000. / getTickFrequency());
+      }
+      int bad = CompareLabels(edges, conns[c], paths[p]);
+      failures += bad;
+      cout << left << setw(16) << "LabelRuns" << right << setw(6) << conns[c] << setw(8) << path_names[p]
+           << fixed << setprecision(2) << setw(10) << best << setw(9) << num_objects << setw(6) << bad << endl;
+    }
+  }
+  return failures ? 1 : 0;
+}
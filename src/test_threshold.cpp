@@ -9,12 +9,11 @@
 #include <iostream>
 #include <opencv2/opencv.hpp>
 
+#include "CannyLib.hpp"
+
 using namespace std;
 using namespace cv;
 
-int otsu_threshold (const Mat& src, Mat& dst, int inv=0);
-int LabelConnected(const Mat& img, Mat& label, uint connectivity=8);
-
 // pack data into struct for track bar callback function
 struct FkOpenCV {
     string winname;
@@ -47,7 +46,7 @@ void on_threshold(int bar_val, void* userdata)
 
   // Test My OTSU threshold function
   Mat my_otsu_mat = cv::Mat::zeros(src.size(), CV_8U);
-  int my_otsu_val = otsu_threshold (src, my_otsu_mat);
+  int my_otsu_val = mycv::Otsu(src, my_otsu_mat);
   imshow( "My OTSU image", my_otsu_mat);
   stringstream ss;
   ss << "My OTSU Value: " << my_otsu_val;
@@ -89,9 +88,10 @@ void on_threshold(int bar_val, void* userdata)
   else
     cout << "ocv_otsu_mat == my_otsuthres_mat" << endl;
 
-  // find connected components
-  Mat labels(my_otsuthres_mat.size(), CV_16UC1, Scalar(0));
-  int num_objects = LabelConnected(my_otsu_mat, labels, 8);
+  // find connected components, the buffers are kept for the next threshold
+  static mycv::Workspace ws;
+  static Mat labels;
+  int num_objects = mycv::Label(my_otsu_mat, labels, ws, 8);
 
   // Create output image coloring the objects
   Mat output= Mat::zeros(src.rows, src.cols, CV_8UC3);